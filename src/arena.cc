@@ -0,0 +1,63 @@
+#include "arena.h"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+using namespace std;
+
+/* Every object is aligned for doubles and SSE loads */
+static const size_t alignment = 16;
+static const size_t firstChunk = 2 << 20;
+static const size_t largestChunk = 256 << 20;
+static const size_t hugePage = 2 << 20;
+
+arena::arena (bool hugePages) {
+	next = end = 0;
+	objects = reservedBytes = usedBytes = 0;
+	huge = hugePages;
+}
+
+arena::~arena () {
+	for (size_t c = 0; c < mapped.size(); ++c)
+		munmap(mapped[c].base, mapped[c].bytes);
+}
+
+void arena::grow (size_t atLeast) {
+	size_t bytes = mapped.empty() ? firstChunk : min(mapped.back().bytes * 2, largestChunk);
+	while (bytes < atLeast)
+		bytes *= 2;
+	void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (huge)
+		p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (p == MAP_FAILED) {
+		/* No reserved huge pages, ask for transparent ones instead */
+		p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			cerr << "can't map " << bytes << " bytes for the scene: " << strerror(errno) << endl;
+			exit(-1);
+		}
+#ifdef MADV_HUGEPAGE
+		if (huge && bytes >= hugePage)
+			madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+	}
+	chunk c = {static_cast<char*>(p), bytes};
+	mapped.push_back(c);
+	next = c.base;
+	end = c.base + bytes;
+	reservedBytes += bytes;
+}
+
+void* arena::allocate (size_t bytes, size_t count) {
+	bytes = (bytes + alignment - 1) & ~(alignment - 1);
+	if ((size_t) (end - next) < bytes)
+		grow(bytes);
+	void *p = next;
+	next += bytes;
+	usedBytes += bytes;
+	objects += count;
+	return p;
+}
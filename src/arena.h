@@ -0,0 +1,67 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * Monotonic allocator for scene objects. Allocation bumps a pointer in
+ * the current chunk; chunks come straight from mmap, doubling in size,
+ * so a scene of millions of triangles costs a handful of system calls
+ * and its objects sit next to each other in load order. Nothing is freed
+ * one at a time: the destructor unmaps the chunks and the objects'
+ * destructors never run, so only objects that own no other memory may
+ * live here.
+ *
+ *   triangle *t = new (store) triangle(p1, p2, p3);
+ */
+class arena {
+	public:
+		/* With hugePages, chunks come from reserved huge pages if there are any, else transparent ones */
+		arena (bool hugePages = false);
+		~arena ();
+		/* bytes for count objects, an array of them counts as count allocations */
+		void* allocate (size_t bytes, size_t count = 1);
+		/* Objects allocated so far */
+		size_t allocations () const {
+			return objects;
+		}
+		/* Chunks mapped, the only calls to the system allocator */
+		size_t chunks () const {
+			return mapped.size();
+		}
+		/* Bytes mapped and bytes handed out */
+		size_t reserved () const {
+			return reservedBytes;
+		}
+		size_t used () const {
+			return usedBytes;
+		}
+		bool hugePages () const {
+			return huge;
+		}
+
+	private:
+		struct chunk {
+			char *base;
+			size_t bytes;
+		};
+		std::vector<chunk> mapped;
+		char *next, *end;
+		size_t objects, reservedBytes, usedBytes;
+		bool huge;
+		void grow (size_t atLeast);
+		/* Not copyable, the chunks belong to one arena */
+		arena (const arena&);
+		arena& operator= (const arena&);
+};
+
+inline void* operator new (size_t bytes, arena &a) {
+	return a.allocate(bytes);
+}
+
+/* Only called if a constructor throws, the memory is reclaimed with the arena */
+inline void operator delete (void *, arena &) {
+}
+
+#endif
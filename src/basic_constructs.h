@@ -1,50 +1,104 @@
 #ifndef BASIC_CONSTRUCTS_H
 #define BASIC_CONSTRUCTS_H
 
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+/*
+ * The math types are plain values: three contiguous doubles, no hidden
+ * state, trivially copyable. Everything used per ray is defined inline
+ * here so the intersection and shading code compiles to straight-line
+ * arithmetic without relying on LTO.
+ */
 class mvector {
 	public:
 		double x,y,z;
-		mvector ();
-		mvector (double x, double y, double z);
-		mvector operator* (double a) const;
-		mvector operator- () const;
-		mvector operator+ (const mvector &v) const;
-		mvector operator- (const mvector &v) const;
-		mvector& operator+= (const mvector &v);
-		double operator* (const mvector &v) const;
-		mvector cross (const mvector &v) const;
+		mvector () : x(0), y(0), z(0) {}
+		mvector (double x, double y, double z) : x(x), y(y), z(z) {}
+		mvector operator* (double a) const {
+			return mvector(x*a, y*a, z*a);
+		}
+		mvector operator- () const {
+			return mvector(-x, -y, -z);
+		}
+		mvector operator+ (const mvector &v) const {
+			return mvector(x + v.x, y + v.y, z + v.z);
+		}
+		mvector operator- (const mvector &v) const {
+			return mvector(x - v.x, y - v.y, z - v.z);
+		}
+		mvector& operator+= (const mvector &v) {
+			x += v.x;
+			y += v.y;
+			z += v.z;
+			return *this;
+		}
+		double operator* (const mvector &v) const {
+			return x*v.x + y*v.y + z*v.z;
+		}
+		mvector cross (const mvector &v) const {
+			return mvector(y*v.z - z*v.y, z*v.x - x*v.z, x*v.y - y*v.x);
+		}
 		/* Don't try to normalize a zero vector ! */
-		void normalize ();
-		void forceNormalize();
-	private:
-		/*
-		 * Is true if normalize was called at least once.
-		 * If you then change x,y,z, normalize won't work.
-		 * Use forceNormalize().
-		 */
-		bool isNormalized;
+		void normalize () {
+			double magnitude = sqrt((*this) * (*this));
+			assert (magnitude != 0);
+			x /= magnitude;
+			y /= magnitude;
+			z /= magnitude;
+		}
 };
 
 class point {
 	public:
 		double x,y,z;
-		point ();
-		point(double x, double y, double z);
-		static double distanceSq(const point  &p1, const point &p2);
-		double operator* (const mvector &n) const;
-		point operator+ (const mvector &v) const;
-		mvector operator- (const point &p) const;
-		point& operator+= (double e);
-		point& operator-= (double e);
+		point () : x(0), y(0), z(0) {}
+		point (double x, double y, double z) : x(x), y(y), z(z) {}
+		static double distanceSq (const point &p1, const point &p2) {
+			double xD = p2.x - p1.x;
+			double yD = p2.y - p1.y;
+			double zD = p2.z - p1.z;
+			return xD*xD + yD*yD + zD*zD;
+		}
+		double operator* (const mvector &n) const {
+			return x*n.x + y*n.y + z*n.z;
+		}
+		point operator+ (const mvector &v) const {
+			return point(x + v.x, y + v.y, z + v.z);
+		}
+		mvector operator- (const point &p) const {
+			return mvector(x - p.x, y - p.y, z - p.z);
+		}
+		point& operator+= (const mvector &v) {
+			x += v.x;
+			y += v.y;
+			z += v.z;
+			return *this;
+		}
+		point& operator+= (double e) {
+			x += e;
+			y += e;
+			z += e;
+			return *this;
+		}
+		point& operator-= (double e) {
+			x -= e;
+			y -= e;
+			z -= e;
+			return *this;
+		}
 };
 
 
 class ray {
 	public:
-		ray ();
-		ray (const point &pt);
-		ray (const point &pt, const mvector &dir);
-		point evaluate (const double t) const ;
+		ray () {}
+		ray (const point &pt) : p(pt) {}
+		ray (const point &pt, const mvector &dir) : p(pt), d(dir) {}
+		point evaluate (const double t) const {
+			return p + (d*t);
+		}
 		point p;
 		mvector d;
 };
@@ -60,27 +114,126 @@ class intersection {
 class RGB {
 	public:
 		double r,g,b;
-		RGB();
-		RGB(double r, double g, double b);
-		bool hasNoEnergy();
-		RGB& operator+= (const RGB &v);
-		RGB& operator*= (const RGB &v);
-		RGB& operator*= (double c);
-		RGB& operator/= (double c);
+		RGB () : r(0.0), g(0.0), b(0.0) {}
+		RGB (double r, double g, double b) : r(r), g(g), b(b) {}
+		bool hasNoEnergy () const {
+			return r == 0.0 && g == 0.0 && b == 0.0;
+		}
+		RGB& operator+= (const RGB &o) {
+			r += o.r;
+			g += o.g;
+			b += o.b;
+			return *this;
+		}
+		RGB& operator*= (const RGB &o) {
+			r *= o.r;
+			g *= o.g;
+			b *= o.b;
+			return *this;
+		}
+		RGB& operator*= (double c) {
+			r *= c;
+			g *= c;
+			b *= c;
+			return *this;
+		}
+		RGB& operator/= (double c) {
+			r /= c;
+			g /= c;
+			b /= c;
+			return *this;
+		}
+};
+
+/* Framebuffer pixel, kept in float until it is written out */
+class fpixel {
+	public:
+		float r, g, b, a;
 };
 
 /* Bounding box class to use for surfaces */
 class bbox {
 	public:
 		point min, max;
-		bbox();
-		bbox(const point &minp, const point &maxp);
-		bool intersect(const ray &r, double start, double end, double &t);
-		mvector getNormal(const point &intersection);
+		bbox() {}
+		bbox(const point &minp, const point &maxp) : min(minp), max(maxp) {
+			pushOut();
+		}
+		inline bool intersect(const ray &r, double start, double end, double &t) const;
+		/*
+		 * True if the ray passes through the box anywhere in [start, end],
+		 * starting inside included. intersect only takes rays entering it,
+		 * which misses everything inside a box around many surfaces.
+		 */
+		inline bool overlaps(const ray &r, double start, double end) const;
+		mvector getNormal(const point &intersection) const;
+		/* Refits the box to a surface moved by delta */
+		void translate(const mvector &delta) {
+			min += delta;
+			max += delta;
+		}
 	private:
 		static const double PUSHOUT = 0.00001;
 		static const double PRECISION = 0.0001;
 		void pushOut();
 };
 
+bool bbox::intersect(const ray &r, double start, double end, double &t) const {
+	double tminx, tmaxx, tminy, tmaxy, tminz, tmaxz, a;
+	a = 1/r.d.x;
+	if (a >= 0) {
+		tminx = a * (min.x - r.p.x);
+		tmaxx = a * (max.x - r.p.x);
+	} else {
+		tminx = a * (max.x - r.p.x);
+		tmaxx = a * (min.x - r.p.x);
+	}
+	a = 1/r.d.y;
+	if (a >= 0) {
+		tminy = a * (min.y - r.p.y);
+		tmaxy = a * (max.y - r.p.y);
+	} else {
+		tminy = a * (max.y - r.p.y);
+		tmaxy = a * (min.y - r.p.y);
+	}
+	a = 1/r.d.z;
+	if (a >= 0) {
+		tminz = a * (min.z - r.p.z);
+		tmaxz = a * (max.z - r.p.z);
+	} else {
+		tminz = a * (max.z - r.p.z);
+		tmaxz = a * (min.z - r.p.z);
+	}
+
+	if (tminx > tmaxy || tminy > tmaxx ||
+			tminy > tmaxz || tminz > tmaxy ||
+				tminx > tmaxz || tminz > tmaxx)
+		return false;
+	/* Nearest intersection t is the largest of the mins */
+	t = std::max(std::max(tminx, tminy), tminz);
+	if (t < start || t > end)
+		return false;
+	return true;
+}
+
+bool bbox::overlaps(const ray &r, double start, double end) const {
+	double a, lo, hi;
+	a = 1/r.d.x;
+	lo = a * ((a >= 0 ? min.x : max.x) - r.p.x);
+	hi = a * ((a >= 0 ? max.x : min.x) - r.p.x);
+	start = std::max(start, lo);
+	end = std::min(end, hi);
+	a = 1/r.d.y;
+	lo = a * ((a >= 0 ? min.y : max.y) - r.p.y);
+	hi = a * ((a >= 0 ? max.y : min.y) - r.p.y);
+	start = std::max(start, lo);
+	end = std::min(end, hi);
+	a = 1/r.d.z;
+	lo = a * ((a >= 0 ? min.z : max.z) - r.p.z);
+	hi = a * ((a >= 0 ? max.z : min.z) - r.p.z);
+	start = std::max(start, lo);
+	end = std::min(end, hi);
+	return start <= end;
+}
+
 #endif
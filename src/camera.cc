@@ -1,6 +1,12 @@
 #include "camera.h"
 #include "sceneobjects.h"
 #include "montecarlo.h"
+#include "exrfile.h"
+#include "workers.h"
+#include "tilecache.h"
+#include "morton.h"
+#include <ImfIntAttribute.h>
+#include <sstream>
 using namespace std;
 
 camera::camera () {
@@ -9,6 +15,7 @@ camera::camera () {
 	d = l = r = t = b = 0.0;
 	nx = ny = 0;
 	pixels = 0;
+	primary = 0;
 }
 
 camera::camera (double x, double y, double z, double vx, double vy, double vz,
@@ -42,33 +49,210 @@ camera::camera (double x, double y, double z, double vx, double vy, double vz,
 	nx = pw;
 	ny = ph;
 
-	pixels = new Rgba[ny * nx];
+	/* Shared, so forked workers render straight into it */
+	pixels = static_cast<fpixel*>(sharedAlloc(sizeof(fpixel) * nx * ny));
+	primary = 0;
 }
 
 camera::~camera () {
-	delete[] pixels;
+	sharedFree(pixels, sizeof(fpixel) * nx * ny);
+	delete primary;
 }
 
-void camera::renderScene(const sceneobjects &objs, int pS, int sS, bool useBBox) {
-	int counter = nx*ny/100, tick = 0;
-	double ratio = 100.0/(nx*ny);
+/* Clamps the requested region to the image, callers check opts.regionInImage first */
+static Box2i getRegion(const renderoptions &opts, int nx, int ny) {
+	int x1 = opts.x1 < 0 ? nx - 1 : min(opts.x1, nx - 1);
+	int y1 = opts.y1 < 0 ? ny - 1 : min(opts.y1, ny - 1);
+	return Box2i(V2i(min(max(opts.x0, 0), x1), min(max(opts.y0, 0), y1)), V2i(x1, y1));
+}
+
+/* Everything a worker needs to render its share of the tiles */
+template <bool correlated, bool useBBox>
+class renderjob {
+public:
+	const sceneobjects *objs;
+	const camerainfo *ci;
+	const renderoptions *opts;
+	fpixel *pixels;
+	telemetry *tel;
+	tilequeue *tiles;
+	primaryhit *hits;
+	bool replay;
+	tilecache *cache;
+
+	/*
+	 * Renders one tile, or takes it from the cache, publishing to telemetry
+	 * slot `worker` once per scanline's worth of pixels. Pixels go along a
+	 * Morton curve through the tile, so consecutive camera rays start out
+	 * close together and meet the same surfaces.
+	 */
+	void renderTile(montecarlo<correlated, useBBox> &m, int tile, int worker, unsigned long &done) {
+		Box2i b = tiles->bounds(tile);
+		int width = b.max.x - b.min.x + 1;
+		int height = b.max.y - b.min.y + 1;
+		if (cache && cache->load(b, pixels, ci->nx)) {
+			done += width * height;
+			tel->publish(worker, done, m.rays);
+		} else {
+			m.resetReach();
+			m.setTile(b.min.x, b.min.y, b.max.x, b.max.y);
+			/* The curve covers a square of side a power of two, codes off the tile are skipped */
+			unsigned int side = 1;
+			while (side < (unsigned int) max(width, height))
+				side <<= 1;
+			int inRow = 0;
+			for (unsigned int code = 0; code < side * side; ++code) {
+				int i = compactBits2(code), j = compactBits2(code >> 1);
+				if (i >= width || j >= height)
+					continue;
+				fpixel &px = pixels[ci->nx*(b.min.y + j) + b.min.x + i];
+				m.setPixel(px, b.min.x + i, b.min.y + j);
+				if (++inRow == width) {
+					done += width;
+					tel->publish(worker, done, m.rays);
+					inRow = 0;
+				}
+			}
+			if (cache)
+				cache->store(b, pixels, ci->nx, m.reachMin, m.reachMax, m.reachEscapes);
+		}
+		tiles->finish(tile);
+		if (opts->tileDone)
+			opts->tileDone(opts->tileContext, b.min.x, b.min.y, b.max.x, b.max.y);
+	}
+
+	/* Only ever a forked worker when there are several processes, which then counts its own events */
+	static void work(int worker, void *ctx) {
+		renderjob *job = static_cast<renderjob*>(ctx);
+		bool counting = job->opts->perf && job->opts->processes > 1;
+		perfcounters counters(counting, worker);
+		montecarlo<correlated, useBBox> m(*job->objs, *job->ci, *job->opts, job->hits, job->replay);
+		if (job->cache)
+			m.trackReach(&job->cache->bounds());
+		unsigned long done = 0;
+		int tile;
+		while (!job->cancelled() && job->tiles->claim(tile))
+			job->renderTile(m, tile, worker, done);
+		if (counting) {
+			unsigned long long counts[perfcounters::NUM_EVENTS];
+			counters.counts(counts);
+			job->tel->publishEvents(worker, counts);
+		}
+	}
+
+	bool cancelled() const {
+		return opts->cancel && *opts->cancel;
+	}
+};
+
+template <bool correlated, bool useBBox>
+static void renderPixels(const sceneobjects &objs, const camerainfo &ci, const renderoptions &opts,
+						fpixel *pixels, telemetry &tel, primaryhit *hits, bool replay) {
+	Box2i region = getRegion(opts, ci.nx, ci.ny);
+	int width = region.max.x - region.min.x + 1;
+	int height = region.max.y - region.min.y + 1;
+	tilequeue tiles(region, opts.tileSize);
+	renderjob<correlated, useBBox> job;
+	job.objs = &objs;
+	job.ci = &ci;
+	job.opts = &opts;
+	job.pixels = pixels;
+	job.tel = &tel;
+	job.tiles = &tiles;
+	job.hits = hits;
+	job.replay = replay;
+	job.cache = opts.tileCache ? new tilecache(opts.tileCache, objs, ci, opts) : 0;
+
+	/* Progress is reported by the telemetry thread, workers only publish counters */
+	tel.start((long) width*height);
+	if (opts.processes <= 1) {
+		renderjob<correlated, useBBox>::work(0, &job);
+	} else if (forkWorkers(opts.processes, opts.pinWorkers, renderjob<correlated, useBBox>::work, &job)) {
+		/* Workers died, finish whatever they left behind in this process */
+		montecarlo<correlated, useBBox> m(objs, ci, opts, hits, replay);
+		if (job.cache)
+			m.trackReach(&job.cache->bounds());
+		unsigned long done = 0;
+		for (int tile = 0; tile < tiles.count() && !job.cancelled(); ++tile)
+			if (!tiles.isDone(tile))
+				job.renderTile(m, tile, opts.processes, done);
+	}
+	if (opts.perf && opts.processes > 1)
+		for (int k = 0; k < opts.processes; ++k) {
+			unsigned long long counts[perfcounters::NUM_EVENTS];
+			tel.events(k, counts);
+			ostringstream who;
+			who << "worker " << k;
+			opts.perf->add(perfcounters::RENDER, who.str(), counts);
+		}
+	tel.stop();
+	if (job.cache) {
+		cout << "\nTile cache: reused " << job.cache->reused() << " of " << tiles.count() << " tiles" << endl;
+		delete job.cache;
+	}
+}
+
+void camera::renderScene(const sceneobjects &objs, const renderoptions &opts, telemetry &tel) {
+	renderScene(objs, opts, tel, pixels);
+}
 
+void camera::renderScene(const sceneobjects &objs, const renderoptions &opts, telemetry &tel, fpixel *target) {
 	/* Do not want to do montecarlo integration here, so sending camera info to montecarlo class */
 	camerainfo ci(eye, u, v, w, d, nx, ny, l, r, t, b);
-	montecarlo m(objs, ci, pS, sS, useBBox);
-
-	for (int j = 0; j < ny; ++j)
-		for (int i = 0; i < nx; ++i, ++counter) {
-			if (counter*ratio > tick)
-				cout << "Progress : " << tick++ << "%\r" << flush;
-			Rgba &px = pixels[nx*j + i];
-			m.setPixel(px, i, j);
-		}
+
+	/* Meshes with levels of detail render at the coarsest level this view can't tell apart */
+	double pixelAngle = min((r - l) / nx, (t - b) / ny) / d;
+	for (size_t m = 0; m < objs.lods.size(); ++m)
+		objs.lods[m]->setView(eye, objs.lodPixels * pixelAngle);
+
+	/* Relighting records the camera rays' hits, or replays them if they still fit */
+	primaryhit *hits = 0;
+	bool replay = false;
+	if (opts.relight) {
+		if (!primary)
+			primary = new gbuffer();
+		replay = primary->matches(opts, nx, ny, objs.geometryVersion);
+		if (!replay)
+			primary->record(opts, nx, ny, objs.geometryVersion);
+		hits = primary->hits;
+	}
+
+	/* Pick the integrator specialization once, instead of branching per ray */
+	bool correlated = opts.pixelSamples > 1 && opts.shadowSamples == 1;
+	if (opts.useBBox) {
+		if (correlated)
+			renderPixels<true, true>(objs, ci, opts, target, tel, hits, replay);
+		else
+			renderPixels<false, true>(objs, ci, opts, target, tel, hits, replay);
+	} else {
+		if (correlated)
+			renderPixels<true, false>(objs, ci, opts, target, tel, hits, replay);
+		else
+			renderPixels<false, false>(objs, ci, opts, target, tel, hits, replay);
+	}
+	if (opts.relight && !replay && !(opts.cancel && *opts.cancel))
+		primary->finish();
+}
+
+Header camera::exrHeader (const renderoptions &opts) const {
+	Box2i display(V2i(0, 0), V2i(nx - 1, ny - 1));
+	bool partial = opts.isPartial(nx, ny);
+	Box2i data = partial ? getRegion(opts, nx, ny) : display;
+
+	Header header(display, data);
+	if (partial) {
+		int total = opts.pixelSamples * opts.pixelSamples;
+		int count = opts.sampleCount < 0 ? total - opts.firstSample
+										 : min(opts.sampleCount, total - opts.firstSample);
+		header.insert("raytraFirstSample", IntAttribute(opts.firstSample));
+		header.insert("raytraSampleCount", IntAttribute(count));
+		header.insert("raytraTotalSamples", IntAttribute(total));
+		header.insert("raytraSeed", IntAttribute((int) opts.seed));
+	}
+	return header;
 }
 
-void camera::writeEXR (const char *outFile) {
-	Box2i cropped(V2i(0, 0), V2i(nx - 1, ny - 1));
-	RgbaOutputFile file(outFile, cropped, cropped, WRITE_RGBA);
-	file.setFrameBuffer(pixels, 1, nx);
-	file.writePixels(cropped.max.y - cropped.min.y + 1);
+void camera::writeEXR (const char *outFile, const renderoptions &opts) {
+	Header header = exrHeader(opts);
+	writeFramebuffer(outFile, header, opts.isPartial(nx, ny) ? FLOAT : HALF, pixels);
 }
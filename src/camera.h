@@ -6,10 +6,14 @@
 #include <ImfMatrixAttribute.h>
 #include <ImfArray.h>
 #include <vector>
+#include <string>
 #include <iostream>
 #include "surface.h"
 #include "basic_constructs.h"
 #include "light.h"
+#include "telemetry.h"
+#include "renderoptions.h"
+#include "gbuffer.h"
 
 using namespace std;
 using namespace Imf;
@@ -24,7 +28,10 @@ class camera {
 		double d;
 		int nx, ny;
 		double l, r, t, b;
-		Rgba *pixels;
+		fpixel *pixels;
+		string name;
+		/* Camera ray hits kept for relighting, 0 until a relight render */
+		gbuffer *primary;
 		void shade(Rgba &pixel, intersection &isect_info, ray &r, sceneobjects &objs);
 
 	public:
@@ -32,8 +39,23 @@ class camera {
 		camera (double x, double y, double z, double vx, double vy, double vz,
 				double d, double iw, double ih, int pw, int ph);
 		~camera ();
-		void renderScene(const sceneobjects &s, int pS, int sS, bool useBBox);
-		void writeEXR (const char *outFile);
+		void renderScene(const sceneobjects &s, const renderoptions &opts, telemetry &tel);
+		/* Renders into target, nx*ny pixels, instead of the camera's own framebuffer */
+		void renderScene(const sceneobjects &s, const renderoptions &opts, telemetry &tel, fpixel *target);
+		int width() const { return nx; }
+		int height() const { return ny; }
+		const string& getName() const { return name; }
+		void setName(const string &n) { name = n; }
+		const fpixel* framebuffer() const { return pixels; }
+		/*
+		 * Full renders are written as half RGBA. Partial renders (see
+		 * renderoptions::isPartial) keep float precision, store only the
+		 * rendered region as the data window and record their sample range
+		 * and seed, for mergeEXR.
+		 */
+		void writeEXR (const char *outFile, const renderoptions &opts);
+		/* The header writeEXR uses, for writing several views to one file */
+		Header exrHeader (const renderoptions &opts) const;
 };
 
 #endif
@@ -0,0 +1,53 @@
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include <cstddef>
+#include <cstring>
+#include "basic_constructs.h"
+
+/*
+ * 64 bit FNV-1a over the bytes of everything added, for naming things by
+ * their contents. Doubles have -0.0 folded into 0.0 so equal values hash
+ * alike.
+ */
+class contenthash {
+	public:
+		contenthash () : h(14695981039346656037ULL) {}
+		void add (const void *data, size_t bytes) {
+			const unsigned char *p = static_cast<const unsigned char*>(data);
+			for (size_t b = 0; b < bytes; ++b)
+				h = (h ^ p[b]) * 1099511628211ULL;
+		}
+		void add (double v) {
+			v += 0.0;
+			add(&v, sizeof(v));
+		}
+		void add (int v) {
+			add(&v, sizeof(v));
+		}
+		void add (unsigned long long v) {
+			add(&v, sizeof(v));
+		}
+		void add (const point &p) {
+			add(p.x);
+			add(p.y);
+			add(p.z);
+		}
+		void add (const mvector &v) {
+			add(v.x);
+			add(v.y);
+			add(v.z);
+		}
+		void add (const RGB &c) {
+			add(c.r);
+			add(c.g);
+			add(c.b);
+		}
+		unsigned long long value () const {
+			return h;
+		}
+	private:
+		unsigned long long h;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "exrfile.h"
+#include <iostream>
+#include <cstddef>
+#include <exception>
+#include <algorithm>
+#include <utility>
+#include <sstream>
+#include <ImfOutputFile.h>
+#include <ImfInputFile.h>
+#include <ImfChannelList.h>
+#include <ImfFrameBuffer.h>
+#include <ImfIntAttribute.h>
+#include <ImfStandardAttributes.h>
+using namespace std;
+
+static const char *channelNames[] = {"R", "G", "B", "A"};
+static const size_t channelOffsets[] = {
+	offsetof(fpixel, r), offsetof(fpixel, g), offsetof(fpixel, b), offsetof(fpixel, a)
+};
+
+/* Adds slices for a framebuffer covering the display window of h, channels named prefix + R G B A */
+static void addSlices (FrameBuffer &fb, const Header &h, const fpixel *pixels, const string &prefix) {
+	const Box2i &display = h.displayWindow();
+	size_t xs = sizeof(fpixel);
+	size_t ys = sizeof(fpixel) * (display.max.x - display.min.x + 1);
+	char *origin = (char *) pixels - display.min.x*xs - display.min.y*ys;
+	for (int c = 0; c < 4; ++c)
+		fb.insert((prefix + channelNames[c]).c_str(), Slice(FLOAT, origin + channelOffsets[c], xs, ys));
+}
+
+static FrameBuffer makeFrameBuffer (const Header &h, const fpixel *pixels) {
+	FrameBuffer fb;
+	addSlices(fb, h, pixels, "");
+	return fb;
+}
+
+void writeFramebuffer (const char *outFile, Header &header, PixelType type, const fpixel *pixels) {
+	for (int c = 0; c < 4; ++c)
+		header.channels().insert(channelNames[c], Channel(type));
+	const Box2i &data = header.dataWindow();
+	OutputFile file(outFile, header);
+	file.setFrameBuffer(makeFrameBuffer(header, pixels));
+	file.writePixels(data.max.y - data.min.y + 1);
+}
+
+void writeMultiView (const char *outFile, Header &header, PixelType type,
+					 const vector<string> &views, const vector<const fpixel*> &pixels) {
+	FrameBuffer fb;
+	for (size_t v = 0; v < views.size(); ++v) {
+		string prefix = v == 0 ? "" : views[v] + ".";
+		for (int c = 0; c < 4; ++c)
+			header.channels().insert((prefix + channelNames[c]).c_str(), Channel(type));
+		addSlices(fb, header, pixels[v], prefix);
+	}
+	addMultiView(header, views);
+	const Box2i &data = header.dataWindow();
+	OutputFile file(outFile, header);
+	file.setFrameBuffer(fb);
+	file.writePixels(data.max.y - data.min.y + 1);
+}
+
+bool readFramebuffer (const char *inFile, Header &header, vector<fpixel> &pixels) {
+	try {
+		InputFile file(inFile);
+		header = file.header();
+		const Box2i &display = header.displayWindow();
+		const Box2i &data = header.dataWindow();
+		fpixel empty = {0, 0, 0, 0};
+		pixels.assign((size_t) (display.max.x - display.min.x + 1) * (display.max.y - display.min.y + 1), empty);
+		file.setFrameBuffer(makeFrameBuffer(header, &pixels[0]));
+		file.readPixels(data.min.y, data.max.y);
+	} catch (const exception &e) {
+		cerr << "can't read " << inFile << ": " << e.what() << endl;
+		return false;
+	}
+	return true;
+}
+
+/* A partial's data window and the range of sample indices it took */
+class partialrange {
+	public:
+		Box2i data;
+		int first, count;
+};
+
+/*
+ * Empty if the sample ranges of the partials covering, taken in order,
+ * are exactly [0, total), else what is wrong with them
+ */
+static string checkSamples (const vector<partialrange> &ranges, const vector<int> &covering, int total) {
+	vector<pair<int, int> > taken;
+	for (size_t c = 0; c < covering.size(); ++c)
+		taken.push_back(make_pair(ranges[covering[c]].first, ranges[covering[c]].count));
+	sort(taken.begin(), taken.end());
+	int next = 0;
+	for (size_t t = 0; t < taken.size(); ++t) {
+		ostringstream problem;
+		if (taken[t].first < next)
+			problem << "samples " << taken[t].first << " to " << min(next, taken[t].first + taken[t].second) - 1
+					<< " are in more than one partial";
+		else if (taken[t].first > next)
+			problem << "samples " << next << " to " << taken[t].first - 1 << " are in no partial";
+		if (!problem.str().empty())
+			return problem.str();
+		next = taken[t].first + taken[t].second;
+	}
+	if (next != total) {
+		ostringstream problem;
+		problem << "samples " << next << " to " << total - 1 << " are in no partial";
+		return problem.str();
+	}
+	return "";
+}
+
+int mergeEXR (const char *outFile, const vector<char*> &partials) {
+	Box2i display;
+	int seed = 0, total = 0;
+	vector<double> sums, weights;
+	vector<partialrange> ranges;
+
+	for (size_t f = 0; f < partials.size(); ++f) {
+		Header h;
+		vector<fpixel> pixels;
+		if (!readFramebuffer(partials[f], h, pixels))
+			return 1;
+		const IntAttribute *count = h.findTypedAttribute<IntAttribute>("raytraSampleCount");
+		const IntAttribute *fileSeed = h.findTypedAttribute<IntAttribute>("raytraSeed");
+		const IntAttribute *first = h.findTypedAttribute<IntAttribute>("raytraFirstSample");
+		const IntAttribute *fileTotal = h.findTypedAttribute<IntAttribute>("raytraTotalSamples");
+		if (!count || !fileSeed || !first || !fileTotal) {
+			cerr << partials[f] << " is not a partial render" << endl;
+			return 1;
+		}
+		if (f == 0) {
+			display = h.displayWindow();
+			seed = fileSeed->value();
+			total = fileTotal->value();
+			sums.assign(pixels.size() * 4, 0.0);
+			weights.assign(pixels.size(), 0.0);
+		} else if (h.displayWindow().min.x != display.min.x || h.displayWindow().min.y != display.min.y ||
+				h.displayWindow().max.x != display.max.x || h.displayWindow().max.y != display.max.y) {
+			cerr << partials[f] << " is a different image size" << endl;
+			return 1;
+		} else if (fileTotal->value() != total) {
+			cerr << partials[f] << " has " << fileTotal->value() << " samples per pixel, not " << total << endl;
+			return 1;
+		} else if (fileSeed->value() != seed) {
+			cerr << "warning: " << partials[f] << " was rendered with a different seed" << endl;
+		}
+
+		const Box2i &data = h.dataWindow();
+		partialrange range;
+		range.data = data;
+		range.first = first->value();
+		range.count = count->value();
+		ranges.push_back(range);
+		int width = display.max.x - display.min.x + 1;
+		double n = count->value();
+		for (int y = data.min.y; y <= data.max.y; ++y)
+			for (int x = data.min.x; x <= data.max.x; ++x) {
+				size_t p = (size_t) (y - display.min.y) * width + (x - display.min.x);
+				const fpixel &px = pixels[p];
+				sums[4*p] += px.r * n;
+				sums[4*p + 1] += px.g * n;
+				sums[4*p + 2] += px.b * n;
+				sums[4*p + 3] += px.a * n;
+				weights[p] += n;
+			}
+	}
+
+	/*
+	 * Every covered pixel must have each of its samples from exactly one
+	 * partial, or the average is not the single render's. Pixels are
+	 * checked once per set of partials covering them.
+	 */
+	vector<int> covering, checked;
+	for (int y = display.min.y; y <= display.max.y; ++y)
+		for (int x = display.min.x; x <= display.max.x; ++x) {
+			covering.clear();
+			for (size_t r = 0; r < ranges.size(); ++r) {
+				const Box2i &d = ranges[r].data;
+				if (x >= d.min.x && x <= d.max.x && y >= d.min.y && y <= d.max.y)
+					covering.push_back((int) r);
+			}
+			if (covering.empty() || covering == checked)
+				continue;
+			checked = covering;
+			string problem = checkSamples(ranges, covering, total);
+			if (!problem.empty()) {
+				cerr << "pixel " << x << "," << y << ": " << problem << ", not merging" << endl;
+				return 1;
+			}
+		}
+
+	size_t uncovered = 0;
+	vector<fpixel> merged(weights.size());
+	for (size_t p = 0; p < weights.size(); ++p) {
+		double w = weights[p];
+		if (w == 0.0) {
+			fpixel empty = {0, 0, 0, 0};
+			merged[p] = empty;
+			++uncovered;
+			continue;
+		}
+		merged[p].r = sums[4*p] / w;
+		merged[p].g = sums[4*p + 1] / w;
+		merged[p].b = sums[4*p + 2] / w;
+		merged[p].a = sums[4*p + 3] / w;
+	}
+	if (uncovered)
+		cerr << "warning: " << uncovered << " pixels are not covered by any partial" << endl;
+
+	Header header(display, display);
+	writeFramebuffer(outFile, header, HALF, &merged[0]);
+	return 0;
+}
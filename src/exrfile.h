@@ -0,0 +1,43 @@
+#ifndef EXRFILE_H
+#define EXRFILE_H
+
+#include <vector>
+#include <string>
+#include <ImfHeader.h>
+#include <ImfPixelType.h>
+#include "basic_constructs.h"
+
+using namespace Imf;
+using namespace Imath;
+
+/*
+ * EXR input and output on float framebuffers. pixels always spans the
+ * whole display window of the header; only the data window is written
+ * or read.
+ */
+void writeFramebuffer (const char *outFile, Header &header, PixelType type, const fpixel *pixels);
+/*
+ * Writes several same sized framebuffers as one multi-view EXR. The
+ * first view is the default one and keeps the plain R G B A channels,
+ * the others are prefixed with their name ("right.R"), as OpenEXR's
+ * multi-view convention expects.
+ */
+void writeMultiView (const char *outFile, Header &header, PixelType type,
+					 const std::vector<std::string> &views, const std::vector<const fpixel*> &pixels);
+/* Returns false, with a message on cerr, if the file can't be read */
+bool readFramebuffer (const char *inFile, Header &header, std::vector<fpixel> &pixels);
+
+/*
+ * Combines partial renders of one frame (see camera::writeEXR) into
+ * outFile. Every pixel is the average of the partials covering it,
+ * weighted by their sample counts. Fails, returning non-zero with a
+ * message on cerr, if the partials covering a pixel miss some of its
+ * samples or take one twice. Returns 0 on success.
+ *
+ * With the same seed, tiles merge into exactly the single process image.
+ * Splitting a pixel's samples goes through float averages, so those
+ * pixels can be off by the last bit of the half float output.
+ */
+int mergeEXR (const char *outFile, const std::vector<char*> &partials);
+
+#endif
@@ -0,0 +1,35 @@
+#include "gbuffer.h"
+#include "workers.h"
+
+gbuffer::gbuffer () {
+	hits = 0;
+	count = 0;
+	complete = false;
+	nx = ny = 0;
+	geometry = 0;
+}
+
+gbuffer::~gbuffer () {
+	sharedFree(hits, sizeof(primaryhit) * count);
+}
+
+bool gbuffer::matches (const renderoptions &opts, int nx, int ny, unsigned long geometry) const {
+	return complete && this->nx == nx && this->ny == ny && this->geometry == geometry &&
+		key.pixelSamples == opts.pixelSamples && key.seed == opts.seed && key.useBBox == opts.useBBox &&
+		key.x0 == opts.x0 && key.y0 == opts.y0 && key.x1 == opts.x1 && key.y1 == opts.y1 &&
+		key.firstSample == opts.firstSample && key.sampleCount == opts.sampleCount;
+}
+
+void gbuffer::record (const renderoptions &opts, int nx, int ny, unsigned long geometry) {
+	size_t needed = (size_t) nx * ny * opts.pixelSamples * opts.pixelSamples;
+	if (needed != count) {
+		sharedFree(hits, sizeof(primaryhit) * count);
+		hits = static_cast<primaryhit*>(sharedAlloc(sizeof(primaryhit) * needed));
+		count = needed;
+	}
+	complete = false;
+	key = opts;
+	this->nx = nx;
+	this->ny = ny;
+	this->geometry = geometry;
+}
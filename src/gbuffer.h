@@ -0,0 +1,51 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <cstddef>
+#include "basic_constructs.h"
+#include "renderoptions.h"
+
+/* The closest hit of one camera sample. surface indexes sceneobjects::surfaces, -1 for a miss */
+class primaryhit {
+	public:
+		double t;
+		mvector n;
+		int surface;
+};
+
+/*
+ * Camera ray hits of a render, one per pixel sample, for relighting
+ * (renderoptions::relight). The first render records them, later renders
+ * with the same samples and geometry take them from here and trace only
+ * shadow and reflection rays. Camera rays are still generated, from the
+ * same random stream, so a replayed image is identical to a traced one.
+ *
+ * Hits name the surface rather than its material, so material changes
+ * are picked up. Costs 40 bytes per sample, in shared memory so forked
+ * workers can record.
+ */
+class gbuffer {
+	public:
+		gbuffer ();
+		~gbuffer ();
+		/* True if a finished render recorded hits for these samples of this geometry */
+		bool matches (const renderoptions &opts, int nx, int ny, unsigned long geometry) const;
+		/* Forgets any hits and makes room for a render with these options to record */
+		void record (const renderoptions &opts, int nx, int ny, unsigned long geometry);
+		/* The recording render finished, its hits can be replayed */
+		void finish () {
+			complete = true;
+		}
+		/* Indexed by (j*nx + i)*pixelSamples^2 + sample */
+		primaryhit *hits;
+
+	private:
+		size_t count;
+		bool complete;
+		/* What the hits were recorded for */
+		renderoptions key;
+		int nx, ny;
+		unsigned long geometry;
+};
+
+#endif
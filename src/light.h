@@ -2,6 +2,8 @@
 #define LIGHT_H
 
 #include "basic_constructs.h"
+#include "random.h"
+#include "sphericalrect.h"
 #include <cstdlib>
 using namespace std;
 
@@ -21,6 +23,12 @@ class light {
 			return loc;
 		}
 		virtual lightType getLightType() =0;
+		void moveTo (const point &l) {
+			loc = l;
+		}
+		void setIntensity (const RGB &ir) {
+			rgb = ir;
+		}
 };
 
 
@@ -53,9 +61,9 @@ class s_light : public light {
 		}
 		virtual lightType getLightType() { return AREA;}
 
-		void getSample (point &toFill, int p, int q, int gridWidth) const {
-			double pR = rand()/(double)RAND_MAX;
-			double qR = rand()/(double)RAND_MAX;
+		void getSample (point &toFill, int p, int q, int gridWidth, rng &random) const {
+			double pR = random.uniform();
+			double qR = random.uniform();
 			mvector u_s = u * (len * (-0.5 + (p + pR)/gridWidth));
 			mvector v_s = v * (len * (-0.5 + (q + qR)/gridWidth));
 			u_s += v_s;
@@ -73,6 +81,39 @@ class s_light : public light {
 			double distanceSq = point::distanceSq(r.evaluate(1.0), r.p);
 			return (spectralD() *= wLight) /= distanceSq;
 		}
+
+		/*
+		 * Sampling by solid angle instead of area. The square as seen from
+		 * o, set up once per shading point; samples from it cover the same
+		 * strata as getSample's, spread evenly over the directions to the
+		 * light instead of over its area.
+		 */
+		sphericalrect seenFrom (const point &o) const {
+			return sphericalrect(loc + (u + v)*(-len/2), u*len, v*len, o);
+		}
+		void getSample (point &toFill, const sphericalrect &seen, int p, int q, int gridWidth, rng &random) const {
+			double pR = random.uniform();
+			double qR = random.uniform();
+			toFill = seen.sample((p + pR)/gridWidth, (q + qR)/gridWidth);
+		}
+		/*
+		 * getWeightedSpectralD's weight for a sample from seen. The area
+		 * estimate's cos/distance^2 is what turns area into solid angle, so
+		 * it cancels, leaving the solid angle over the area. Constant but
+		 * for the emitter's own cosine, so close lights stay quiet.
+		 */
+		RGB getWeightedSpectralD (const ray &r, const sphericalrect &seen) {
+			mvector toLight = r.d;
+			toLight.normalize();
+			double wLight = max(0.0, -(dir*toLight));
+			mvector n = u.cross(v);
+			double area = sqrt(n*n) * len*len;
+			n.normalize();
+			double cosLight = fabs(n*toLight);
+			if (wLight == 0.0 || cosLight == 0.0)
+				return RGB();
+			return spectralD() *= wLight * seen.solidAngle / (cosLight * area);
+		}
 };
 
 /* Not really a light. */
@@ -0,0 +1,119 @@
+#include "lodmesh.h"
+#include "meshcleanup.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <utility>
+#include <new>
+using namespace std;
+
+lodmesh::lodmesh (const vector<int> &tris, const vector<double> &verts, int material, arena &store) {
+	mat = material;
+	count = current = 0;
+	addLevel(tris, verts, 0.0, store);
+
+	double inf = numeric_limits<double>::infinity();
+	double lo[3] = {inf, inf, inf}, hi[3] = {-inf, -inf, -inf};
+	for (size_t v = 0; v < verts.size(); v += 3)
+		for (int a = 0; a < 3; ++a) {
+			lo[a] = min(lo[a], verts[v + a]);
+			hi[a] = max(hi[a], verts[v + a]);
+		}
+	double extent = max(max(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]);
+	box = bbox(point(lo[0], lo[1], lo[2]), point(hi[0], hi[1], hi[2]));
+
+	/* Coarser grids until the mesh is small, keeping levels that at least halve the last */
+	size_t vertexCount = verts.size() / 3;
+	for (double cell = extent / 1024.0; cell < extent && count < maxLevels; cell *= 2.0) {
+		if (levels[count - 1].count <= minTriangles / 16)
+			break;
+		vector<pair<unsigned long long, int> > cells(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v) {
+			unsigned long long key = 0;
+			for (int a = 0; a < 3; ++a)
+				key |= (unsigned long long) floor((verts[3*v + a] - lo[a]) / cell) << (21 * a);
+			cells[v] = make_pair(key, (int) v);
+		}
+		sort(cells.begin(), cells.end());
+
+		/* Each cluster becomes the mean of its vertices, which stays inside its cell */
+		vector<int> cluster(vertexCount), coarseTris(tris);
+		vector<double> coarseVerts;
+		for (size_t i = 0; i < vertexCount; ) {
+			size_t j = i;
+			double sum[3] = {0.0, 0.0, 0.0};
+			for (; j < vertexCount && cells[j].first == cells[i].first; ++j) {
+				cluster[cells[j].second] = (int) coarseVerts.size() / 3;
+				for (int a = 0; a < 3; ++a)
+					sum[a] += verts[3*cells[j].second + a];
+			}
+			for (int a = 0; a < 3; ++a)
+				coarseVerts.push_back(sum[a] / (j - i));
+			i = j;
+		}
+		for (size_t t = 0; t < coarseTris.size(); ++t)
+			coarseTris[t] = cluster[coarseTris[t]];
+		/* Collapsed and doubled faces go */
+		meshcleanup().clean(coarseTris, coarseVerts);
+		if (coarseTris.size() / 3 * 2 > levels[count - 1].count || coarseTris.empty())
+			continue;
+		addLevel(coarseTris, coarseVerts, cell * sqrt(3.0), store);
+	}
+}
+
+void lodmesh::addLevel (const vector<int> &tris, const vector<double> &verts, double error, arena &store) {
+	lodlevel level;
+	level.count = tris.size() / 3;
+	level.error = error;
+	level.tris = static_cast<triangle*>(store.allocate(sizeof(triangle) * level.count, level.count));
+	for (size_t t = 0; t < level.count; ++t) {
+		const double *p1 = &verts[3*tris[3*t]], *p2 = &verts[3*tris[3*t + 1]], *p3 = &verts[3*tris[3*t + 2]];
+		triangle *tr = new (level.tris + t) triangle(point(p1[0], p1[1], p1[2]), point(p2[0], p2[1], p2[2]),
+													 point(p3[0], p3[1], p3[2]));
+		tr->setMaterial(mat);
+	}
+	levels[count++] = level;
+}
+
+void lodmesh::setView (const point &eye, double angle) {
+	/* Nearest point of the box, the eye itself if it is inside */
+	point near(max(box.min.x, min(eye.x, box.max.x)), max(box.min.y, min(eye.y, box.max.y)),
+			   max(box.min.z, min(eye.z, box.max.z)));
+	double distance = sqrt(point::distanceSq(eye, near));
+	current = 0;
+	for (int l = 1; l < count; ++l)
+		if (levels[l].error <= distance * angle)
+			current = l;
+}
+
+/* Closest hit in the current level, ties to the first triangle like the scene loop */
+bool lodmesh::intersect (const ray &r, double start, double end, intersection &info) {
+	if (!box.overlaps(r, start, end))
+		return false;
+	const lodlevel &level = levels[current];
+	bool hit = false;
+	for (size_t s = 0; s < level.count; ++s)
+		if (level.tris[s].intersect(r, start, end, info)) {
+			end = info.t;
+			hit = true;
+		}
+	/* The mesh's material may have changed since the triangles were built */
+	if (hit)
+		info.mat = mat;
+	return hit;
+}
+
+void lodmesh::translate (const mvector &delta) {
+	box.translate(delta);
+	for (int l = 0; l < count; ++l)
+		for (size_t s = 0; s < levels[l].count; ++s)
+			levels[l].tris[s].translate(delta);
+}
+
+/* The full detail mesh, the coarser levels follow from it, and the level rays see */
+void lodmesh::hash (contenthash &h) const {
+	h.add('l');
+	h.add(current);
+	for (size_t s = 0; s < levels[0].count; ++s)
+		levels[0].tris[s].hash(h);
+}
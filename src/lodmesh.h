@@ -0,0 +1,58 @@
+#ifndef LODMESH_H
+#define LODMESH_H
+
+#include <vector>
+#include <cstddef>
+#include "surface.h"
+#include "triangle.h"
+#include "arena.h"
+
+/*
+ * A large OBJ mesh with simplified copies of itself (the w directive
+ * with sceneobjects::lodPixels set). Each coarser level clusters the
+ * vertices on a grid twice as coarse, replaces each cluster by the mean
+ * of its vertices and drops the faces that collapse, so no vertex moves
+ * further than a cell's diagonal; that is the level's error.
+ *
+ * Before each view renders, setView picks the coarsest level whose error,
+ * seen from the eye at the nearest point of the mesh's box, stays under
+ * the given angle. Every ray of that view then sees the same level, so
+ * shadow and reflection rays agree with the camera rays about where the
+ * surface is. A mesh around the eye always renders at full detail.
+ */
+class lodmesh : public surface {
+	public:
+		/* Meshes with fewer triangles are not worth simplifying */
+		static const size_t minTriangles = 4096;
+		/* tris and verts as readWavefrontFile gives them, triangles are built in store */
+		lodmesh (const std::vector<int> &tris, const std::vector<double> &verts, int material, arena &store);
+		bool intersect (const ray &r, double start, double end, intersection &info);
+		void translate (const mvector &delta);
+		void hash (contenthash &h) const;
+		/* Picks the level for rays from eye, allowing angle radians of error */
+		void setView (const point &eye, double angle);
+		int levelCount () const {
+			return count;
+		}
+		int currentLevel () const {
+			return current;
+		}
+		size_t triangles (int level) const {
+			return levels[level].count;
+		}
+
+	private:
+		/* Grids from 1/1024 of the mesh up to its size, and full detail */
+		static const int maxLevels = 12;
+		struct lodlevel {
+			triangle *tris;
+			size_t count;
+			double error;
+		};
+		/* Not a vector, the mesh lives in the arena and is never destroyed */
+		lodlevel levels[maxLevels];
+		int count, current;
+		void addLevel (const std::vector<int> &tris, const std::vector<double> &verts, double error, arena &store);
+};
+
+#endif
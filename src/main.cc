@@ -1,52 +1,383 @@
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <sstream>
 #include <vector>
-#include <cassert>
+#include <ctime>
+#include <exception>
 #include "readscene.h"
+#include "perfcounters.h"
+#include "exrfile.h"
+#include "server.h"
+#include "sequence.h"
+#include "quantizedmesh.h"
 
 using namespace std;
 
-int main(int argc, char **argv) {
-	int pSamples, sSamples;
-	bool useBBox = false;
-	switch (argc) {
-	case 5:
-		pSamples = atoi(argv[3]);
-		sSamples = atoi(argv[4]);
+/* out.exr and suffix "left" give out.left.exr */
+static string suffixedFileName (const string &out, const string &suffix) {
+	size_t dot = out.rfind('.');
+	size_t slash = out.rfind('/');
+	if (dot == string::npos || (slash != string::npos && dot < slash))
+		return out + "." + suffix;
+	return out.substr(0, dot) + "." + suffix + out.substr(dot);
+}
+
+/* The views to render, all of them unless viewList names some. False, with a message on cerr, if they can't be */
+static bool pickViews (sceneobjects &objs, const string &viewList, bool multiView, vector<camera*> &views) {
+	if (viewList.empty())
+		views = objs.cameras;
+	else {
+		istringstream names(viewList);
+		string name;
+		while (getline(names, name, ',')) {
+			camera *cam = objs.findCamera(name);
+			if (!cam) {
+				cerr << "error: the scene has no camera called " << name << endl;
+				return false;
+			}
+			views.push_back(cam);
+		}
+	}
+	if (views.empty()) {
+		cerr << "error: the scene has no camera" << endl;
+		return false;
+	}
+	if (multiView) {
+		for (size_t v = 1; v < views.size(); ++v)
+			if (views[v]->width() != views[0]->width() || views[v]->height() != views[0]->height()) {
+				cerr << "error: views in a multi-view file must be the same size" << endl;
+				return false;
+			}
+	}
+	return true;
+}
+
+/* One image per view, unless they all go in one multi-view file */
+static void writeViews (const string &out, const vector<camera*> &views, const renderoptions &opts, bool multiView) {
+	if (multiView) {
+		vector<string> names;
+		vector<const fpixel*> pixels;
+		for (size_t v = 0; v < views.size(); ++v) {
+			names.push_back(views[v]->getName());
+			pixels.push_back(views[v]->framebuffer());
+		}
+		Header header = views[0]->exrHeader(opts);
+		writeMultiView(out.c_str(), header, opts.isPartial(views[0]->width(), views[0]->height()) ? FLOAT : HALF,
+					   names, pixels);
+	} else if (views.size() == 1) {
+		views[0]->writeEXR(out.c_str(), opts);
+	} else {
+		for (size_t v = 0; v < views.size(); ++v)
+			views[v]->writeEXR(suffixedFileName(out, views[v]->getName()).c_str(), opts);
+	}
+}
+
+/* Prints how to call raytra, returns the exit status for that */
+static int usage () {
+	cout << "Usage: raytra scenefilename outputexrfilename pixelSamples shadowSamples [useBBox]\n"
+		 << "              [--stats file|unix:socketpath] [--stats-interval ms] [--perf]\n"
+		 << "              [--max-depth n] [--min-throughput x] [--roulette]\n"
+		 << "              [--seed n] [--region x0 y0 x1 y1] [--samples first count]\n"
+		 << "              [--processes n] [--pin] [--tile size]\n"
+		 << "              [--views name,name...] [--multiview] [--sequence file] [--relight]\n"
+		 << "              [--tile-cache dir] [--huge-pages] [--proxy-budget MB]\n"
+		 << "              [--quantize 16|21] [--clean-meshes] [--lod pixels] [--sphere-clouds]\n"
+		 << "              [--morton] [--adaptive-shadows] [--solid-angle-lights]\n"
+		 << "       raytra --merge outputexrfilename partialexrfilename...\n"
+		 << "       raytra --server socketpath [options]\n";
+	return 1;
+}
+
+/* All of main but reporting what escapes it */
+static int run (int argc, char **argv) {
+	renderoptions opts;
+	string statsTarget;
+	int statsInterval = 1000;
+	bool usePerf = false;
+	bool merge = false;
+	bool haveSeed = false;
+	string serverSocket;
+	string viewList;
+	bool multiView = false;
+	char *sequenceFile = 0;
+	bool hugePages = false;
+	double proxyBudget = 0.0;
+	int quantizeBits = 0;
+	bool cleanMeshes = false;
+	double lodPixels = 0.0;
+	bool sphereClouds = false;
+	bool mortonOrder = false;
+
+	/* Options may appear anywhere, everything else is positional */
+	vector<char*> args;
+	for (int a = 1; a < argc; ++a) {
+		if (!strcmp(argv[a], "--stats") && a + 1 < argc)
+			statsTarget = argv[++a];
+		else if (!strcmp(argv[a], "--stats-interval") && a + 1 < argc)
+			statsInterval = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--perf"))
+			usePerf = true;
+		else if (!strcmp(argv[a], "--max-depth") && a + 1 < argc)
+			opts.maxDepth = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--min-throughput") && a + 1 < argc)
+			opts.minThroughput = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--roulette"))
+			opts.russianRoulette = true;
+		else if (!strcmp(argv[a], "--seed") && a + 1 < argc) {
+			opts.seed = strtoul(argv[++a], 0, 10);
+			haveSeed = true;
+		} else if (!strcmp(argv[a], "--region") && a + 4 < argc) {
+			opts.x0 = atoi(argv[++a]);
+			opts.y0 = atoi(argv[++a]);
+			opts.x1 = atoi(argv[++a]);
+			opts.y1 = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--samples") && a + 2 < argc) {
+			opts.firstSample = atoi(argv[++a]);
+			opts.sampleCount = atoi(argv[++a]);
+		} else if (!strcmp(argv[a], "--processes") && a + 1 < argc)
+			opts.processes = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--pin"))
+			opts.pinWorkers = true;
+		else if (!strcmp(argv[a], "--tile") && a + 1 < argc)
+			opts.tileSize = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--server") && a + 1 < argc)
+			serverSocket = argv[++a];
+		else if (!strcmp(argv[a], "--views") && a + 1 < argc)
+			viewList = argv[++a];
+		else if (!strcmp(argv[a], "--sequence") && a + 1 < argc)
+			sequenceFile = argv[++a];
+		else if (!strcmp(argv[a], "--tile-cache") && a + 1 < argc)
+			opts.tileCache = argv[++a];
+		else if (!strcmp(argv[a], "--proxy-budget") && a + 1 < argc)
+			proxyBudget = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--quantize") && a + 1 < argc)
+			quantizeBits = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--lod") && a + 1 < argc)
+			lodPixels = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--morton"))
+			mortonOrder = true;
+		else if (!strcmp(argv[a], "--sphere-clouds"))
+			sphereClouds = true;
+		else if (!strcmp(argv[a], "--clean-meshes"))
+			cleanMeshes = true;
+		else if (!strcmp(argv[a], "--huge-pages"))
+			hugePages = true;
+		else if (!strcmp(argv[a], "--solid-angle-lights"))
+			opts.solidAngleLights = true;
+		else if (!strcmp(argv[a], "--adaptive-shadows"))
+			opts.adaptiveShadows = true;
+		else if (!strcmp(argv[a], "--relight"))
+			opts.relight = true;
+		else if (!strcmp(argv[a], "--multiview"))
+			multiView = true;
+		else if (!strcmp(argv[a], "--merge"))
+			merge = true;
+		else
+			args.push_back(argv[a]);
+	}
+
+	if (merge) {
+		if (args.size() < 2) {
+			cout << "Usage: raytra --merge outputexrfilename partialexrfilename...\n";
+			return 1;
+		}
+		return mergeEXR(args[0], vector<char*>(args.begin() + 1, args.end()));
+	}
+
+	if (!serverSocket.empty()) {
+		if (!haveSeed)
+			opts.seed = time(0);
+		telemetry tel;
+		tel.setTarget(statsTarget, statsInterval);
+		renderserver server(serverSocket, opts, tel);
+		return server.run();
+	}
+
+	switch (args.size()) {
+	case 4:
+		opts.pixelSamples = atoi(args[2]);
+		opts.shadowSamples = atoi(args[3]);
 		break;
-	case 6:
-		pSamples = atoi(argv[3]);
-		sSamples = atoi(argv[4]);
-		useBBox = true;
+	case 5:
+		opts.pixelSamples = atoi(args[2]);
+		opts.shadowSamples = atoi(args[3]);
+		opts.useBBox = true;
 		break;
 	default:
-		cout << "Usage: raytra scenefilename outputexrfilename pixelSamples shadowSamples [useBBox] \n";
-		return 1;
+		return usage();
 	}
-	char *sceneFile = argv[1];
-	char *outputFile = argv[2];
+	char *sceneFile = args[0];
+	char *outputFile = args[1];
 
-	/* Assert samples are valid */
-	assert (pSamples >= 1 && sSamples >= 1);
+	if (opts.pixelSamples < 1 || opts.shadowSamples < 1 || opts.maxDepth < 1) {
+		cerr << "error: pixelSamples, shadowSamples and --max-depth must be at least 1" << endl;
+		return usage();
+	}
+	if (opts.processes < 1 || opts.processes >= telemetry::maxThreads || opts.tileSize < 1) {
+		cerr << "error: --processes must be from 1 to " << telemetry::maxThreads - 1
+			 << " and --tile at least 1" << endl;
+		return usage();
+	}
+	if (quantizeBits != 0 && quantizeBits != 16 && quantizeBits != 21) {
+		cerr << "error: --quantize takes 16 or 21" << endl;
+		return usage();
+	}
+	if (!opts.validRanges()) {
+		cerr << "error: --samples needs a first sample below pixelSamples^2 and a count of at least 1, "
+			 << "--region needs x0 <= x1 and y0 <= y1" << endl;
+		return usage();
+	}
+	/* Each picks how OBJ meshes are stored, so at most one can apply */
+	if ((proxyBudget > 0.0) + (quantizeBits != 0) + (lodPixels > 0.0) > 1) {
+		cerr << "error: --proxy-budget, --quantize and --lod each store meshes their own way, pick one" << endl;
+		return usage();
+	}
+	if (!haveSeed)
+		opts.seed = time(0);
 
-	sceneobjects objs;
-	// Put a default material in
-	objs.materials.push_back(new material());
+	perfcounters perf(usePerf, 0);
+
+	/* On the heap so its teardown can be timed */
+	sceneobjects *scene = new sceneobjects(hugePages);
+	sceneobjects &objs = *scene;
+	if (proxyBudget > 0.0)
+		objs.proxies = new proxycache((size_t) (proxyBudget * (1 << 20)));
+	objs.quantizeBits = quantizeBits;
+	objs.cleanMeshes = cleanMeshes;
+	objs.lodPixels = lodPixels;
+	objs.sphereClouds = sphereClouds;
+	objs.mortonOrder = mortonOrder;
+	if (usePerf) {
+		objs.perf = &perf;
+		opts.perf = &perf;
+	}
+	if (objs.proxies)
+		objs.proxies->cleanMeshes = cleanMeshes;
 
 	// Parse the scene file
-	parseSceneFile(sceneFile, objs);
-	cout << "Parsed scene and loaded objects. Rendering ..." <<endl;
+	perf.begin(perfcounters::LOAD);
+	string sceneError;
+	if (!parseSceneFile(sceneFile, objs, sceneError)) {
+		cerr << "error: " << sceneError << endl;
+		return 1;
+	}
+	perf.end(perfcounters::LOAD);
+	cout << "Parsed scene and loaded objects: " << objs.store.allocations() << " allocations in "
+		 << objs.store.chunks() << " chunks, " << objs.store.used() / (1 << 20) << "MB"
+		 << (objs.store.hugePages() ? " on huge pages" : "") << endl;
+	if (cleanMeshes && objs.cleaned.meshes) {
+		const meshcleanup &c = objs.cleaned;
+		cout << "Cleaned " << c.meshes << " meshes: welded " << c.welded << " vertices, dropped "
+			 << c.unused << " unused vertices, " << c.degenerate << " degenerate and " << c.duplicates
+			 << " duplicate faces, kept " << c.facesKept << " faces" << endl;
+	}
+	for (size_t m = 0; m < objs.lods.size(); ++m) {
+		cout << "Levels of detail for mesh " << m << ":";
+		for (int l = 0; l < objs.lods[m]->levelCount(); ++l)
+			cout << " " << objs.lods[m]->triangles(l);
+		cout << " triangles" << endl;
+	}
+	if (quantizeBits) {
+		size_t triangles = 0, bytes = 0;
+		for (size_t s = 0; s < objs.surfaces.size(); ++s)
+			if (quantizedmesh *qm = dynamic_cast<quantizedmesh*>(objs.surfaces[s])) {
+				triangles += qm->triangles();
+				bytes += qm->bytes();
+			}
+		cout << "Quantized " << triangles << " triangles to " << quantizeBits << " bits, "
+			 << (triangles ? (double) bytes / triangles : 0.0) << " bytes per triangle" << endl;
+	}
+	cout << "Rendering with seed " << opts.seed << " ..." <<endl;
+
+	sequence *anim = sequenceFile ? new sequence(sequenceFile) : 0;
+	int frames = anim ? anim->frames() : 1;
+
+	telemetry tel;
+	tel.setTarget(statsTarget, statsInterval);
+	tel.annotate("scene_allocations", objs.store.allocations());
+	tel.annotate("scene_chunks", objs.store.chunks());
+	tel.annotate("scene_bytes", objs.store.used());
+	unsigned long rays = 0;
+	double seconds = 0.0, updateSeconds = 0.0;
+	double sequenceStart = telemetry::now();
+	for (int frame = 0; frame < frames; ++frame) {
+		string frameFile = outputFile;
+		if (anim) {
+			/* Change the resident scene instead of reloading it */
+			double updateStart = telemetry::now();
+			anim->apply(frame, objs);
+			updateSeconds += telemetry::now() - updateStart;
+			char number[16];
+			sprintf(number, "%04d", frame);
+			frameFile = suffixedFileName(outputFile, number);
+			cout << "Frame " << frame << endl;
+		}
 
-	/* Do we have a camera */
-	assert (objs.getCamera());
+		/* Cameras can change between frames, so views are picked again */
+		vector<camera*> views;
+		if (!pickViews(objs, viewList, multiView, views))
+			return 1;
+		for (size_t v = 0; v < views.size(); ++v)
+			if (!opts.regionInImage(views[v]->width(), views[v]->height())) {
+				cerr << "error: --region lies outside the " << views[v]->width() << "x" << views[v]->height()
+					 << " image" << endl;
+				return 1;
+			}
 
-	// Render the scene
-	objs.getCamera()->renderScene(objs, pSamples, sSamples, useBBox);
+		// Render every view over the same scene
+		perf.begin(perfcounters::RENDER);
+		for (size_t v = 0; v < views.size(); ++v) {
+			if (views.size() > 1)
+				cout << "View " << views[v]->getName() << endl;
+			views[v]->renderScene(objs, opts, tel);
+			if (!objs.lods.empty()) {
+				cout << "\nMesh levels of detail used:";
+				for (size_t m = 0; m < objs.lods.size(); ++m)
+					cout << " " << objs.lods[m]->currentLevel();
+				cout << endl;
+			}
+			rays += tel.totalRays();
+			seconds += tel.elapsed();
+		}
+		perf.end(perfcounters::RENDER);
+
+		perf.begin(perfcounters::WRITE);
+		writeViews(frameFile, views, opts, multiView);
+		perf.end(perfcounters::WRITE);
+	}
+	cout << "\nRendered " << rays << " rays in " << seconds << "s ("
+		 << (seconds > 0.0 ? (long) (rays / seconds) : 0) << " rays/s)";
+	if (anim) {
+		cout << "\nSequence of " << frames << " frames took " << telemetry::now() - sequenceStart
+			 << "s, " << updateSeconds << "s of it updating the scene";
+		delete anim;
+	}
 
-	// Write the output image
-	objs.getCamera()->writeEXR(outputFile);
+	if (objs.proxies)
+		cout << "\nMesh proxies: " << objs.proxies->loads << " loads, " << objs.proxies->evictions
+			 << " evictions, peak " << objs.proxies->peakBytes / (1 << 20) << "MB";
+	double teardownStart = telemetry::now();
+	delete scene;
+	double teardown = telemetry::now() - teardownStart;
+	tel.annotate("teardown_sec", teardown);
+	tel.republish();
+	cout << "\nScene teardown took " << teardown << "s";
 
 	cout << "\nDone" << endl;
+	if (usePerf)
+		perf.report(cout);
 
 	return 0;
 }
+
+int main(int argc, char **argv) {
+	try {
+		return run(argc, argv);
+	} catch (const exception &e) {
+		cerr << "error: " << e.what() << endl;
+		return 1;
+	}
+}
@@ -1,10 +1,12 @@
 #include "material.h"
+#include <cstring>
 
 material::material() {
 	phong_exponent = 0.0;
 	diffuse.r = diffuse.b = diffuse.g = 0.0;
 	specular.r = specular.b = specular.g = 0.0;
 	ideal_reflective.r = ideal_reflective.b = ideal_reflective.g = 0.0;
+	classify();
 }
 
 material::material (double dr, double dg, double db, double sr, double sg,
@@ -19,12 +21,51 @@ material::material (double dr, double dg, double db, double sr, double sg,
 	ideal_reflective.g = ig;
 	ideal_reflective.b = ib;
 	phong_exponent = r;
+	classify();
 }
 
-bool material::isSame (double dr, double dg, double db, double sr, double sg,
-						double sb, double r, double ir, double ig, double ib) const {
-	return  diffuse.r == dr && diffuse.g == dg && diffuse.b == db &&
-			specular.r == sr && specular.g == sg && specular.b == sb &&
-			ideal_reflective.r == ir && ideal_reflective.g == ig && ideal_reflective.b == ib &&
-			phong_exponent == r;
+void material::classify () {
+	if (!specular.hasNoEnergy())
+		kind = SPECULAR;
+	else if (!diffuse.hasNoEnergy())
+		kind = DIFFUSE;
+	else
+		kind = MIRROR;
+	/* Squaring takes about log2(exponent) multiplies, past 1024 pow wins */
+	if (phong_exponent >= 0.0 && phong_exponent <= 1024.0 && phong_exponent == (int) phong_exponent)
+		intExponent = (int) phong_exponent;
+	else
+		intExponent = -1;
+}
+
+bool material::operator== (const material &m) const {
+	return  diffuse.r == m.diffuse.r && diffuse.g == m.diffuse.g && diffuse.b == m.diffuse.b &&
+			specular.r == m.specular.r && specular.g == m.specular.g && specular.b == m.specular.b &&
+			ideal_reflective.r == m.ideal_reflective.r && ideal_reflective.g == m.ideal_reflective.g &&
+			ideal_reflective.b == m.ideal_reflective.b && phong_exponent == m.phong_exponent;
+}
+
+/* FNV-1a over the bits of every field, -0.0 folded into 0.0 to agree with == */
+size_t material::hash () const {
+	double fields[] = {diffuse.r, diffuse.g, diffuse.b, specular.r, specular.g, specular.b,
+					   ideal_reflective.r, ideal_reflective.g, ideal_reflective.b, phong_exponent};
+	size_t h = 2166136261u;
+	for (size_t f = 0; f < sizeof(fields)/sizeof(fields[0]); ++f) {
+		double v = fields[f] + 0.0;
+		unsigned char bytes[sizeof(double)];
+		memcpy(bytes, &v, sizeof(v));
+		for (size_t b = 0; b < sizeof(bytes); ++b)
+			h = (h ^ bytes[b]) * 16777619u;
+	}
+	return h;
+}
+
+int materialtable::intern (const material &m) {
+	std::tr1::unordered_map<material, int, hasher>::iterator found = index.find(m);
+	if (found != index.end())
+		return found->second;
+	int i = (int) mats.size();
+	mats.push_back(m);
+	index[m] = i;
+	return i;
 }
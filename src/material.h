@@ -1,18 +1,71 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <vector>
+#include <cstddef>
+#include <tr1/unordered_map>
 #include "basic_constructs.h"
 
 class material {
 	public:
+		/*
+		 * What the shading actually has to compute:
+		 *   MIRROR   - no diffuse or specular, direct light is skipped
+		 *   DIFFUSE  - lambertian only
+		 *   SPECULAR - lambertian and blinn phong
+		 * Reflection is independent of this, see ideal_reflective.
+		 */
+		enum shadingClass {MIRROR, DIFFUSE, SPECULAR};
 		material ();
 		material (double dr, double dg, double db, double sr, double sg,
 				  double sb, double r, double ir, double ig, double ib);
-		bool isSame (double dr, double dg, double db, double sr, double sg,
-					double sb, double r, double ir, double ig, double ib) const ;
+		bool operator== (const material &m) const;
+		size_t hash () const;
 		bool isRefractive () const;
+		/* Must be called again if the colours or exponent are changed */
+		void classify ();
+		/* x^phong_exponent, by squaring when the exponent is a small integer */
+		double specularPower (double x) const {
+			if (intExponent < 0)
+				return pow(x, phong_exponent);
+			double ret = 1.0;
+			for (int e = intExponent; e; e >>= 1, x *= x)
+				if (e & 1)
+					ret *= x;
+			return ret;
+		}
 		RGB diffuse, specular, ideal_reflective;
 		double phong_exponent;
+		shadingClass kind;
+	private:
+		int intExponent;
+};
+
+/*
+ * All materials of a scene, stored by value in one array. intern() hands
+ * back the index of an equal material if there is one, so repeated
+ * m lines in a scene file share an entry.
+ */
+class materialtable {
+	public:
+		int intern (const material &m);
+		const material& operator[] (int i) const {
+			return mats[i];
+		}
+		material& operator[] (int i) {
+			return mats[i];
+		}
+		size_t size () const {
+			return mats.size();
+		}
+	private:
+		struct hasher {
+			size_t operator() (const material &m) const {
+				return m.hash();
+			}
+		};
+		std::vector<material> mats;
+		std::tr1::unordered_map<material, int, hasher> index;
 };
 
 #endif
@@ -0,0 +1,155 @@
+#include "meshcleanup.h"
+#include "morton.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+using namespace std;
+
+/* Vertex indices by position, then by index so the first of equals leads */
+class positionorder {
+	public:
+		positionorder (const vector<double> &v) : verts(v) {}
+		bool operator() (int a, int b) const {
+			const double *p = &verts[3*a], *q = &verts[3*b];
+			if (p[0] != q[0])
+				return p[0] < q[0];
+			if (p[1] != q[1])
+				return p[1] < q[1];
+			if (p[2] != q[2])
+				return p[2] < q[2];
+			return a < b;
+		}
+	private:
+		const vector<double> &verts;
+};
+
+/* A face by its sorted vertices, or by its place on the curve */
+class facekey {
+	public:
+		int v[3];
+		unsigned int morton;
+		size_t face;
+		bool operator< (const facekey &o) const {
+			for (int k = 0; k < 3; ++k)
+				if (v[k] != o.v[k])
+					return v[k] < o.v[k];
+			return face < o.face;
+		}
+};
+
+static bool curveOrder (const facekey &a, const facekey &b) {
+	return a.morton != b.morton ? a.morton < b.morton : a.face < b.face;
+}
+
+void meshcleanup::clean (vector<int> &tris, vector<double> &verts) {
+	int vertexCount = (int) (verts.size() / 3);
+	size_t faceCount = tris.size() / 3;
+	++meshes;
+
+	/* Weld, every vertex to the first one at its position */
+	vector<int> order(vertexCount), same(vertexCount);
+	for (int v = 0; v < vertexCount; ++v)
+		order[v] = v;
+	sort(order.begin(), order.end(), positionorder(verts));
+	int weldedHere = 0;
+	for (int i = 0; i < vertexCount; ++i) {
+		int v = order[i];
+		const double *p = &verts[3*v];
+		if (i > 0) {
+			const double *q = &verts[3*same[order[i - 1]]];
+			if (p[0] == q[0] && p[1] == q[1] && p[2] == q[2]) {
+				same[v] = same[order[i - 1]];
+				++weldedHere;
+				continue;
+			}
+		}
+		same[v] = v;
+	}
+
+	welded += weldedHere;
+
+	/* Degenerate faces go, including those naming a vertex that isn't there */
+	vector<facekey> keys;
+	keys.reserve(faceCount);
+	for (size_t f = 0; f < faceCount; ++f) {
+		facekey k;
+		bool valid = true;
+		for (int c = 0; c < 3; ++c) {
+			int v = tris[3*f + c];
+			valid = valid && v >= 0 && v < vertexCount;
+			k.v[c] = valid ? same[v] : -1;
+		}
+		if (valid && k.v[0] != k.v[1] && k.v[1] != k.v[2] && k.v[0] != k.v[2]) {
+			const double *a = &verts[3*k.v[0]], *b = &verts[3*k.v[1]], *c = &verts[3*k.v[2]];
+			double e1x = b[0] - a[0], e1y = b[1] - a[1], e1z = b[2] - a[2];
+			double e2x = c[0] - a[0], e2y = c[1] - a[1], e2z = c[2] - a[2];
+			/* No area, so the determinant in triangle::solve is 0 for every ray */
+			valid = e1y*e2z - e1z*e2y != 0.0 || e1z*e2x - e1x*e2z != 0.0 || e1x*e2y - e1y*e2x != 0.0;
+		} else
+			valid = false;
+		if (!valid) {
+			++degenerate;
+			continue;
+		}
+		k.face = f;
+		keys.push_back(k);
+	}
+
+	/* Duplicates go, keeping the first, which the scene would hit first anyway */
+	vector<facekey> sorted(keys);
+	for (size_t k = 0; k < sorted.size(); ++k)
+		sort(sorted[k].v, sorted[k].v + 3);
+	sort(sorted.begin(), sorted.end());
+	vector<char> drop(faceCount, 0);
+	for (size_t k = 1; k < sorted.size(); ++k)
+		if (sorted[k].v[0] == sorted[k - 1].v[0] && sorted[k].v[1] == sorted[k - 1].v[1] &&
+				sorted[k].v[2] == sorted[k - 1].v[2]) {
+			drop[sorted[k].face] = 1;
+			++duplicates;
+		}
+	size_t kept = 0;
+	for (size_t k = 0; k < keys.size(); ++k)
+		if (!drop[keys[k].face])
+			keys[kept++] = keys[k];
+	keys.resize(kept);
+
+	/* Faces along a Morton curve through their centroids, over the bounds of those kept */
+	double inf = numeric_limits<double>::infinity();
+	double lo[3] = {inf, inf, inf}, hi[3] = {-inf, -inf, -inf};
+	for (size_t k = 0; k < keys.size(); ++k)
+		for (int c = 0; c < 3; ++c)
+			for (int a = 0; a < 3; ++a) {
+				lo[a] = min(lo[a], verts[3*keys[k].v[c] + a]);
+				hi[a] = max(hi[a], verts[3*keys[k].v[c] + a]);
+			}
+	for (size_t k = 0; k < keys.size(); ++k) {
+		unsigned int cell[3];
+		for (int a = 0; a < 3; ++a) {
+			double centroid = (verts[3*keys[k].v[0] + a] + verts[3*keys[k].v[1] + a] + verts[3*keys[k].v[2] + a]) / 3.0;
+			double extent = hi[a] - lo[a];
+			cell[a] = extent > 0.0 ? (unsigned int) min(1023.0, floor((centroid - lo[a]) / extent * 1024.0)) : 0;
+		}
+		keys[k].morton = mortonCode3(cell[0], cell[1], cell[2]);
+	}
+	sort(keys.begin(), keys.end(), curveOrder);
+
+	/* Vertices renumbered in the order the faces reach them, unused ones left out */
+	vector<int> renumber(vertexCount, -1);
+	vector<double> packed;
+	packed.reserve(verts.size());
+	tris.resize(3 * keys.size());
+	int next = 0;
+	for (size_t k = 0; k < keys.size(); ++k)
+		for (int c = 0; c < 3; ++c) {
+			int v = keys[k].v[c];
+			if (renumber[v] < 0) {
+				renumber[v] = next++;
+				packed.insert(packed.end(), verts.begin() + 3*v, verts.begin() + 3*v + 3);
+			}
+			tris[3*k + c] = renumber[v];
+		}
+	/* Welded vertices are counted already */
+	unused += vertexCount - weldedHere - next;
+	verts.swap(packed);
+	facesKept += keys.size();
+}
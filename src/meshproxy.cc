@@ -0,0 +1,162 @@
+#include "meshproxy.h"
+#include "readscene.h"
+#include "meshcleanup.h"
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <new>
+using namespace std;
+
+proxycache::proxycache (size_t budgetBytes) {
+	budget = budgetBytes;
+	usedBytes = peakBytes = 0;
+	loads = evictions = 0;
+	clock = 0;
+	cleanMeshes = false;
+}
+
+proxycache::~proxycache () {
+	while (!loaded.empty())
+		evict(loaded.size() - 1);
+}
+
+int proxycache::addFile (const string &file) {
+	files.push_back(file);
+	return (int) files.size() - 1;
+}
+
+/* Triangles hold nothing that needs destroying, the memory just goes back */
+void proxycache::evict (size_t l) {
+	meshproxy *p = loaded[l];
+	operator delete(p->tris);
+	p->tris = 0;
+	usedBytes -= p->bytes();
+	loaded[l] = loaded.back();
+	loaded.pop_back();
+}
+
+void proxycache::require (meshproxy *p) {
+	p->lastUse = ++clock;
+	if (p->tris)
+		return;
+
+	/* Make room, least recently used first */
+	while (!loaded.empty() && usedBytes + p->bytes() > budget) {
+		size_t oldest = 0;
+		for (size_t l = 1; l < loaded.size(); ++l)
+			if (loaded[l]->lastUse < loaded[oldest]->lastUse)
+				oldest = l;
+		evict(oldest);
+		++evictions;
+	}
+
+	vector<int> tris;
+	vector<double> verts;
+	string error;
+	if (!readWavefrontFile(files[p->file].c_str(), tris, verts, error))
+		tris.clear();
+	if (cleanMeshes)
+		meshcleanup().clean(tris, verts);
+	p->count = tris.size() / 3;
+	p->tris = static_cast<triangle*>(operator new(p->bytes()));
+	for (size_t t = 0; t < p->count; ++t) {
+		int p1_i = 3*tris[3*t];
+		int p2_i = 3*tris[3*t + 1];
+		int p3_i = 3*tris[3*t + 2];
+		point p1 = point (verts[p1_i], verts[p1_i+1], verts[p1_i+2]) + p->offset;
+		point p2 = point (verts[p2_i], verts[p2_i+1], verts[p2_i+2]) + p->offset;
+		point p3 = point (verts[p3_i], verts[p3_i+1], verts[p3_i+2]) + p->offset;
+		triangle *tr = new (p->tris + t) triangle(p1, p2, p3);
+		tr->setMaterial(p->mat);
+	}
+	loaded.push_back(p);
+	usedBytes += p->bytes();
+	peakBytes = max(peakBytes, usedBytes);
+	++loads;
+}
+
+meshproxy::meshproxy (proxycache &c, const string &name, string &error) : cache(c) {
+	file = cache.addFile(name);
+	count = 0;
+	tris = 0;
+	lastUse = 0;
+
+	ifstream in(name.c_str());
+	if (!in.is_open()) {
+		error = "can't open mesh " + name;
+		return;
+	}
+	double inf = numeric_limits<double>::infinity();
+	point lo(inf, inf, inf), hi(-inf, -inf, -inf);
+	contenthash lines;
+	string line;
+	/* One based, as the file has them; checked once every vertex is counted */
+	int vertices = 0, lowest = 1, highest = 0;
+	while (getline(in, line)) {
+		if (line.size() < 2 || line[1] != ' ')
+			continue;
+		if (line[0] == 'f' || line[0] == 'v')
+			lines.add(line.c_str(), line.size() + 1);
+		if (line[0] == 'f') {
+			++count;
+			istringstream iss(line.substr(2));
+			int i = 0, j = 0, k = 0;
+			iss >> i >> j >> k;
+			lowest = min(lowest, min(i, min(j, k)));
+			highest = max(highest, max(i, max(j, k)));
+		} else if (line[0] == 'v') {
+			++vertices;
+			istringstream iss(line.substr(2));
+			double x, y, z;
+			iss >> x >> y >> z;
+			lo.x = min(lo.x, x);
+			lo.y = min(lo.y, y);
+			lo.z = min(lo.z, z);
+			hi.x = max(hi.x, x);
+			hi.y = max(hi.y, y);
+			hi.z = max(hi.z, z);
+		}
+	}
+	if (lowest < 1 || highest > vertices) {
+		ostringstream bad;
+		bad << name << ": a face names vertex " << (lowest < 1 ? lowest : highest) << " of " << vertices;
+		error = bad.str();
+		return;
+	}
+	box = bbox(lo, hi);
+	digest = lines.value();
+}
+
+bool meshproxy::intersect (const ray &r, double start, double end, intersection &info) {
+	if (!box.overlaps(r, start, end))
+		return false;
+	cache.require(this);
+	bool hit = false;
+	for (size_t s = 0; s < count; ++s)
+		if (tris[s].intersect(r, start, end, info)) {
+			/* Only nearer hits from here on */
+			end = info.t;
+			hit = true;
+		}
+	/* The proxy's material may have changed since the triangles loaded */
+	if (hit)
+		info.mat = mat;
+	return hit;
+}
+
+void meshproxy::translate (const mvector &delta) {
+	offset += delta;
+	box.translate(delta);
+	for (size_t s = 0; tris && s < count; ++s)
+		tris[s].translate(delta);
+}
+
+/* The mesh by name, contents as read for the bounds, and placement */
+void meshproxy::hash (contenthash &h) const {
+	const string &name = cache.file(file);
+	h.add('w');
+	h.add(name.data(), name.size());
+	h.add(digest);
+	h.add(box.min);
+	h.add(box.max);
+}
@@ -0,0 +1,82 @@
+#ifndef MESHPROXY_H
+#define MESHPROXY_H
+
+#include <string>
+#include <vector>
+#include "surface.h"
+#include "triangle.h"
+
+class meshproxy;
+
+/*
+ * Triangles of the mesh proxies in a scene, loaded on demand and kept
+ * under a memory budget. When loading a mesh would go over budget, the
+ * least recently hit meshes are dropped first; a mesh larger than the
+ * whole budget still loads, alone. A mesh that is dropped is read again
+ * from its OBJ the next time a ray reaches it, so the budget should hold
+ * the meshes a tile's rays touch or rendering spends its time reloading.
+ *
+ * Not thread safe. Forked workers each get their own copy, with the
+ * same budget.
+ */
+class proxycache {
+	public:
+		proxycache (size_t budgetBytes);
+		/* Frees the loaded triangles, the proxies themselves live in the scene arena */
+		~proxycache ();
+		/* Returns the index to name a proxy's file by */
+		int addFile (const std::string &file);
+		const std::string& file (int index) const {
+			return files[index];
+		}
+		/*
+		 * Loads p's triangles if they are not in memory, and marks p used.
+		 * A mesh that can no longer be read loads with no triangles.
+		 */
+		void require (meshproxy *p);
+		size_t loads, evictions, peakBytes;
+		/* Run meshes through meshcleanup on every load; nothing is counted, loads repeat */
+		bool cleanMeshes;
+
+	private:
+		size_t budget, usedBytes;
+		unsigned long clock;
+		std::vector<std::string> files;
+		std::vector<meshproxy*> loaded;
+		void evict (size_t l);
+};
+
+/*
+ * An OBJ mesh known only by its bounds until a ray reaches its box (the
+ * w directive when the scene has a proxycache). It then intersects as
+ * its triangles would, closest hit first, ties to the first triangle.
+ */
+class meshproxy : public surface {
+	public:
+		/*
+		 * Reads only the bounds and size of the mesh. Sets error if the
+		 * file can't be read or a face names a vertex it doesn't have.
+		 */
+		meshproxy (proxycache &cache, const std::string &file, std::string &error);
+		bool intersect (const ray &r, double start, double end, intersection &info);
+		void translate (const mvector &delta);
+		void hash (contenthash &h) const;
+		size_t bytes () const {
+			return count * sizeof(triangle);
+		}
+
+	private:
+		friend class proxycache;
+		proxycache &cache;
+		int file;
+		size_t count;
+		/* 0 unless loaded */
+		triangle *tris;
+		unsigned long lastUse;
+		/* Sum of translations, applied to the triangles as they load */
+		mvector offset;
+		/* Of the file's v and f lines, so editing the mesh changes the hash */
+		unsigned long long digest;
+};
+
+#endif
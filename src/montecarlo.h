@@ -3,16 +3,12 @@
 
 #include "basic_constructs.h"
 #include <limits>
-#include <ctime>
-#include <cstdlib>
 #include <cassert>
-#include <ImfRgbaFile.h>
-#include <ImfStringAttribute.h>
-#include <ImfMatrixAttribute.h>
-#include <ImfArray.h>
 #include "light.h"
-using namespace Imf;
-using namespace Imath;
+#include "material.h"
+#include "random.h"
+#include "renderoptions.h"
+#include "gbuffer.h"
 
 /* Wrapper for transferring camera information over */
 class camerainfo {
@@ -37,52 +33,146 @@ public:
 	double l, r, t, b;
 };
 
+/*
+ * The integrator is specialized at compile time on the sampling mode so
+ * the per ray loops carry no configuration branches:
+ *   correlated - one shadow ray per primary ray (p > 1, s == 1), where
+ *                stratified primary samples are mapped onto light samples
+ *   useBBox    - bounding box preview, surfaces are their boxes
+ * camera::renderScene picks the instantiation once per render.
+ */
+template <bool correlated, bool useBBox>
 class montecarlo {
 private:
-	enum rayType {VIEWING_RAY, SHADOW_RAY, REFLECTION_RAY, REFRACTION_RAY};
-	RGB L (const ray &r, rayType rt, double min_t, double max_t, unsigned int rel_light, int recursionC, int rayID);
-	inline bool getClosestIntersection (const ray &r, double min_t, double max_t, intersection &i);
+	RGB L (const ray &r, int rayID, primaryhit *cached);
+	template <material::shadingClass kind>
+	inline void directLight (const ray &r, const point &isection, const mvector &norm, const material &mat,
+							int rayID, RGB &ret);
+	inline bool intersect (surface *s, const ray &r, double min_t, double max_t, intersection &i);
+	inline bool getClosestIntersection (const ray &r, double min_t, double max_t, intersection &i, int &which,
+										const vector<int> *candidates = 0);
 	inline bool isOccluded (const ray &r, double min_t, double max_t);
 	inline ray getRay(int i, int j, int p, int q);
-	inline ray getRegularRay(int i, int j);
-	inline void createMapping();
-	inline RGB getLightSpectralDensity(const ray &r, double min_t, double max_t, int rel_light);
-	void blinn_phong (const ray &r, mvector &norm, mvector &l, material *mat, RGB &l_spd, RGB &ret);
-	bool singleShadowRay, singlePrimaryRay, useBBox;
+	inline void createMapping(unsigned long long pixel);
+	inline RGB pointLightSpectralDensity(const ray &r, const p_light *l);
+	inline RGB areaLightSpectralDensity(const ray &r, s_light *l, const sphericalrect *seen);
+	inline bool shadowRayClear(const ray &r);
+	template <material::shadingClass kind>
+	void adaptiveAreaLight (const ray &r, const point &isection, mvector &norm, const material &mat, s_light *sl,
+							const sphericalrect *seen, RGB &ret);
+	template <material::shadingClass kind>
+	void blinn_phong (const ray &r, mvector &norm, mvector &l, const material &mat, RGB &l_spd, RGB &ret);
 	int pixelSamples, shadowSamples;
+	int maxDepth, rouletteDepth;
+	double minThroughput;
+	bool russianRoulette;
+	int firstSample, lastSample;
+	unsigned long long seed;
+	rng random;
 	vector<int> correlatedShadows;
+	/* Adaptive shadows: which strata per side go in the first pass, and per sample buffers */
+	bool adaptiveShadows;
+	/* Sample area lights by solid angle, see s_light::seenFrom */
+	bool solidAngleLights;
+	vector<char> coarseStratum;
+	vector<point> lightSamples;
+	vector<char> sampleLit;
+	/* Lights split by type up front so shading never asks getLightType() */
+	vector<p_light*> pointLights;
+	vector<s_light*> areaLights;
+	/* Camera ray hits to record into, or with replay to take instead of tracing */
+	primaryhit *hits;
+	bool replay;
+	/* Surfaces the current tile's camera rays can reach, in scene order, see setTile */
+	vector<int> tileSurfaces;
+	/* Scene bounds while reach is tracked, else 0 */
+	const bbox *reachBounds;
+	inline void extendReach (const point &p);
+	inline void escapeReach (const ray &r);
 public:
 	const sceneobjects &objs;
 	const camerainfo &caminfo;
 	int pSampleSq, sSampleSq;
-	montecarlo(const sceneobjects &objs, const camerainfo &ci, int pSamples, int sSamples, bool bbox);
-	void setPixel (Rgba &pixel, int i, int j);
+	/* Rays traced so far, read by the render loop for telemetry */
+	unsigned long rays;
+	montecarlo(const sceneobjects &objs, const camerainfo &ci, const renderoptions &opts,
+			   primaryhit *hits = 0, bool replay = false);
+	void setPixel (fpixel &pixel, int i, int j);
+	/*
+	 * Culls the surfaces for camera rays through pixels x0..x1, y0..y1:
+	 * only those whose box reaches into the tile's frustum are tried.
+	 * Call before the tile's setPixel calls.
+	 */
+	void setTile (int x0, int y0, int x1, int y1);
+	/*
+	 * With bounds set, every ray segment traced grows the box reachMin,
+	 * reachMax; rays that hit nothing count up to where they leave bounds
+	 * and set reachEscapes. For tilecache.
+	 */
+	void trackReach (const bbox *bounds) {
+		reachBounds = bounds;
+	}
+	void resetReach () {
+		double inf = infinity;
+		reachMin = point(inf, inf, inf);
+		reachMax = point(-inf, -inf, -inf);
+		reachEscapes = false;
+	}
+	point reachMin, reachMax;
+	bool reachEscapes;
 	static const double precision = 0.00001;
-	static const int recursionLimit = 5;
 	const double infinity;
 
 };
 
-montecarlo::montecarlo(const sceneobjects &o, const camerainfo &ci, int pSamples, int sSamples, bool bbox)
-: objs(o), caminfo(ci), infinity(numeric_limits<double>::infinity()){
-	pSampleSq = pSamples;
-	sSampleSq = sSamples;
-	pixelSamples = pSamples * pSamples;
-	shadowSamples = sSamples * sSamples;
-	srand(time(0));
-	singlePrimaryRay = pSampleSq == 1 ? true : false;
-	singleShadowRay = sSampleSq == 1 ? true : false;
-	useBBox = bbox;
+template <bool correlated, bool useBBox>
+montecarlo<correlated, useBBox>::montecarlo(const sceneobjects &o, const camerainfo &ci, const renderoptions &opts,
+											 primaryhit *hits, bool replay)
+: hits(hits), replay(replay), reachBounds(0), objs(o), caminfo(ci), infinity(numeric_limits<double>::infinity()){
+	rays = 0;
+	resetReach();
+	pSampleSq = opts.pixelSamples;
+	sSampleSq = opts.shadowSamples;
+	pixelSamples = pSampleSq * pSampleSq;
+	shadowSamples = sSampleSq * sSampleSq;
+	maxDepth = opts.maxDepth;
+	minThroughput = opts.minThroughput;
+	russianRoulette = opts.russianRoulette;
+	adaptiveShadows = opts.adaptiveShadows;
+	solidAngleLights = opts.solidAngleLights;
+	/* Corners and an even spread between, about the square root of the strata per side */
+	int coarse = max(2, (int) ceil(sqrt((double) sSampleSq)));
+	coarseStratum.assign(sSampleSq, 0);
+	for (int k = 0; k < coarse; ++k)
+		coarseStratum[(int) floor(k * (sSampleSq - 1.0) / (coarse - 1) + 0.5)] = 1;
+	lightSamples.resize(shadowSamples);
+	sampleLit.resize(shadowSamples);
+	rouletteDepth = opts.rouletteDepth;
+	seed = opts.seed;
+	firstSample = opts.firstSample;
+	lastSample = opts.sampleCount < 0 ? pixelSamples : min(pixelSamples, firstSample + opts.sampleCount);
+	assert (firstSample >= 0 && firstSample < lastSample);
+	assert (correlated == (pSampleSq > 1 && sSampleSq == 1));
 	/* Use the correlated shuffling only if p, s where p > 1 and s == 1 */
-	if (!singlePrimaryRay && singleShadowRay)
+	if (correlated)
 		for (int p = 0; p < pixelSamples; p++)
 			correlatedShadows.push_back(p);
 
+	for (size_t s = 0; s < objs.lights.size(); ++s) {
+		light *l = objs.lights[s];
+		if (l->getLightType() == light::POINT)
+			pointLights.push_back(static_cast<p_light*>(l));
+		else
+			areaLights.push_back(static_cast<s_light*>(l));
+	}
+	/* Until a tile is set, camera rays may go anywhere in the image */
+	setTile(0, 0, ci.nx - 1, ci.ny - 1);
 }
 
-ray montecarlo::getRay(int i, int j, int p, int q) {
-	double r = rand()/(double) RAND_MAX;
-	double s = rand()/(double) RAND_MAX;
+template <bool correlated, bool useBBox>
+ray montecarlo<correlated, useBBox>::getRay(int i, int j, int p, int q) {
+	double r = random.uniform();
+	double s = random.uniform();
 	double u_s = caminfo.l + (caminfo.r - caminfo.l)*(i - 0.5 + (p + r)/pSampleSq)/caminfo.nx;
 	double v_s = caminfo.t - (caminfo.t - caminfo.b)*(j - 0.5 + (q + s)/pSampleSq)/caminfo.ny;
 	mvector raydir = (caminfo.u * u_s) + (caminfo.v * v_s) + (caminfo.w * -caminfo.d);
@@ -90,195 +180,471 @@ ray montecarlo::getRay(int i, int j, int p, int q) {
 	return ret;
 }
 
+template <bool correlated, bool useBBox>
+bool montecarlo<correlated, useBBox>::intersect (surface *s, const ray &r, double min_t, double max_t, intersection &is) {
+	if (useBBox)
+		return s->intersectBBox(r, min_t, max_t, is);
+	return s->intersect(r, min_t, max_t, is);
+}
+
 /*
- * Populates is with closest intersection info if has one and returns true,
- * else false and is is unchanged
+ * Populates is with closest intersection info and which with the index
+ * of the surface hit if has one and returns true, else false and is is unchanged
  */
-bool montecarlo::getClosestIntersection (const ray &r, double min_t, double max_t, intersection &is) {
+template <bool correlated, bool useBBox>
+bool montecarlo<correlated, useBBox>::getClosestIntersection (const ray &r, double min_t, double max_t, intersection &is,
+															  int &which, const vector<int> *candidates) {
 	const vector<surface *> &sfs = objs.surfaces;
-	size_t size = sfs.size();
-	bool *isSurfIsect = new bool[size];
-	intersection *surfIsect = new intersection[size];
+	intersection candidate;
+	double closest = infinity;
 	bool hit = false;
-	for (unsigned int s = 0; s < size; ++s)
-		hit |= (isSurfIsect[s] = (sfs[s])->intersect(r, min_t, max_t, surfIsect[s], useBBox));
-
-	/* If hit, we must have a closest surface */
-	if (hit) {
-		double closest = infinity;
-		int closest_i = -1;
-		for (unsigned int iter = 0; iter < size; ++iter)
-			if (isSurfIsect[iter])
-				if (surfIsect[iter].t < closest) {
-					closest = surfIsect[iter].t;
-					closest_i = iter;
-				}
-		assert (closest_i >= 0);
-		is = surfIsect[closest_i];
+	/* Ties keep the first surface hit, candidates are in scene order too */
+	if (candidates) {
+		size_t size = candidates->size();
+		for (size_t c = 0; c < size; ++c) {
+			int s = (*candidates)[c];
+			if (intersect(sfs[s], r, min_t, max_t, candidate) && candidate.t < closest) {
+				closest = candidate.t;
+				is = candidate;
+				which = s;
+				hit = true;
+			}
+		}
+		return hit;
 	}
-	delete[] surfIsect;
-	delete[] isSurfIsect;
+	size_t size = sfs.size();
+	for (size_t s = 0; s < size; ++s)
+		if (intersect(sfs[s], r, min_t, max_t, candidate) && candidate.t < closest) {
+			closest = candidate.t;
+			is = candidate;
+			which = (int) s;
+			hit = true;
+		}
 	return hit;
 }
 
-bool montecarlo::isOccluded (const ray &r, double min_t, double max_t) {
+/*
+ * The tile's camera rays fill a pyramid from the eye through the image
+ * plane rectangle their jittered samples cover. Each side of it is a plane
+ * through the eye; a box wholly outside one of them can't be hit. The
+ * rectangle is taken a pixel wider all round so rounding in getRay never
+ * puts a ray outside it.
+ */
+template <bool correlated, bool useBBox>
+void montecarlo<correlated, useBBox>::setTile (int x0, int y0, int x1, int y1) {
+	const camerainfo &c = caminfo;
+	double u0 = c.l + (c.r - c.l)*(x0 - 1.5)/c.nx, u1 = c.l + (c.r - c.l)*(x1 + 1.5)/c.nx;
+	double v0 = c.t - (c.t - c.b)*(y0 - 1.5)/c.ny, v1 = c.t - (c.t - c.b)*(y1 + 1.5)/c.ny;
+	mvector corner[4] = {
+		c.u*u0 + c.v*v0 + c.w*-c.d, c.u*u1 + c.v*v0 + c.w*-c.d,
+		c.u*u1 + c.v*v1 + c.w*-c.d, c.u*u0 + c.v*v1 + c.w*-c.d
+	};
+	mvector center = corner[0] + corner[1] + corner[2] + corner[3];
+	mvector side[4];
+	for (int k = 0; k < 4; ++k) {
+		side[k] = corner[k].cross(corner[(k + 1) % 4]);
+		if (side[k] * center < 0.0)
+			side[k] = -side[k];
+	}
+
+	const vector<surface *> &sfs = objs.surfaces;
+	tileSurfaces.clear();
+	for (size_t s = 0; s < sfs.size(); ++s) {
+		const surface *sf = sfs[s];
+		bool inside = true;
+		/* The box corner furthest along each side's inward normal */
+		for (int k = 0; k < 4 && inside && sf->bounded(); ++k) {
+			const mvector &n = side[k];
+			point far(n.x >= 0.0 ? sf->box.max.x : sf->box.min.x, n.y >= 0.0 ? sf->box.max.y : sf->box.min.y,
+					  n.z >= 0.0 ? sf->box.max.z : sf->box.min.z);
+			inside = (far - c.eye) * n >= 0.0;
+		}
+		if (inside)
+			tileSurfaces.push_back((int) s);
+	}
+}
+
+template <bool correlated, bool useBBox>
+bool montecarlo<correlated, useBBox>::isOccluded (const ray &r, double min_t, double max_t) {
 	const vector<surface *> &sfs = objs.surfaces;
 	intersection dummy;
 	size_t size = sfs.size();
-	bool hit = false;
-	for (unsigned int s = 0; s < size && !hit; ++s)
-		hit |= sfs[s]->intersect(r, min_t, max_t, dummy, useBBox);
-	return hit;
+	for (size_t s = 0; s < size; ++s)
+		if (intersect(sfs[s], r, min_t, max_t, dummy))
+			return true;
+	return false;
+}
+
+template <bool correlated, bool useBBox>
+void montecarlo<correlated, useBBox>::extendReach (const point &p) {
+	reachMin.x = min(reachMin.x, p.x);
+	reachMin.y = min(reachMin.y, p.y);
+	reachMin.z = min(reachMin.z, p.z);
+	reachMax.x = max(reachMax.x, p.x);
+	reachMax.y = max(reachMax.y, p.y);
+	reachMax.z = max(reachMax.z, p.z);
+}
+
+/* A ray that hit nothing reaches from its origin to where it leaves the scene bounds */
+template <bool correlated, bool useBBox>
+void montecarlo<correlated, useBBox>::escapeReach (const ray &r) {
+	reachEscapes = true;
+	extendReach(r.p);
+	const double p[3] = {r.p.x, r.p.y, r.p.z};
+	const double d[3] = {r.d.x, r.d.y, r.d.z};
+	const double lo[3] = {reachBounds->min.x, reachBounds->min.y, reachBounds->min.z};
+	const double hi[3] = {reachBounds->max.x, reachBounds->max.y, reachBounds->max.z};
+	double tNear = 0.0, tFar = infinity;
+	for (int a = 0; a < 3; ++a) {
+		if (d[a] == 0.0) {
+			if (p[a] < lo[a] || p[a] > hi[a])
+				return;
+			continue;
+		}
+		double t1 = (lo[a] - p[a]) / d[a];
+		double t2 = (hi[a] - p[a]) / d[a];
+		tNear = max(tNear, min(t1, t2));
+		tFar = min(tFar, max(t1, t2));
+	}
+	if (tNear <= tFar)
+		extendReach(r.evaluate(tFar));
 }
 
 /* If we have 1 Shadow Ray per Primary Ray, create a mapping from stratified points to light points */
-void montecarlo::createMapping() {
+template <bool correlated, bool useBBox>
+void montecarlo<correlated, useBBox>::createMapping(unsigned long long pixel) {
+	/* Seeded per pixel, so every sample range of this pixel sees the same mapping */
+	rng shuffle(rng::mix(seed, pixel, ~0ULL));
+	for (int p = 0; p < pixelSamples; p++)
+		correlatedShadows[p] = p;
 	for (int p = 0; p < pixelSamples; p++) {
 		int temp = correlatedShadows[p];
-		int swapee = rand()%pixelSamples;
+		int swapee = shuffle.below(pixelSamples);
 		correlatedShadows[p] = correlatedShadows[swapee];
 		correlatedShadows[swapee] =  temp;
 	}
 }
 
-RGB montecarlo::getLightSpectralDensity(const ray &r, double min_t, double max_t, int rel_lgt) {
-	if (isOccluded(r, min_t, max_t))
+/* Shadow rays run from the hit point to the light at t = 1 */
+template <bool correlated, bool useBBox>
+RGB montecarlo<correlated, useBBox>::pointLightSpectralDensity(const ray &r, const p_light *l) {
+	++rays;
+	if (reachBounds) {
+		extendReach(r.p);
+		extendReach(r.evaluate(1.0));
+	}
+	if (isOccluded(r, precision, 1.0))
+		return RGB();
+	return l->spectralD() /= (point::distanceSq(l->getPosition(), r.p));
+}
+
+/* seen is the light from r.p when sampling by solid angle, else 0 */
+template <bool correlated, bool useBBox>
+RGB montecarlo<correlated, useBBox>::areaLightSpectralDensity(const ray &r, s_light *l, const sphericalrect *seen) {
+	if (!shadowRayClear(r))
 		return RGB();
-	light *l = objs.lights[rel_lgt];
-	if (l->getLightType() == light::POINT) {
-		return l->spectralD() /= (point::distanceSq(l->getPosition(), r.p));
+	return seen ? l->getWeightedSpectralD(r, *seen) : l->getWeightedSpectralD(r);
+}
+
+/* Traces a shadow ray to a light sample at t = 1 */
+template <bool correlated, bool useBBox>
+bool montecarlo<correlated, useBBox>::shadowRayClear(const ray &r) {
+	++rays;
+	if (reachBounds) {
+		extendReach(r.p);
+		extendReach(r.evaluate(1.0));
 	}
-	/* Area light */
-	s_light *sl = static_cast<s_light*>(l);
-	return sl->getWeightedSpectralD(r);
+	return !isOccluded(r, precision, 1.0);
+}
+
+/*
+ * One area light's share of direct light, tracing the shadow rays of a
+ * coarse grid of strata first, the light's corners among them. If they
+ * all reach the light, or none does, the other strata are taken to agree;
+ * only points where they disagree, in a penumbra, trace every stratum.
+ * Samples are drawn in the same order as when every ray is traced, so
+ * penumbra points get exactly that estimate. The grid grows with the
+ * square root of the strata per side, so estimates still converge as
+ * shadow samples go up; what a coarse grid can miss is a shadow thinner
+ * than its spacing.
+ */
+template <bool correlated, bool useBBox>
+template <material::shadingClass kind>
+void montecarlo<correlated, useBBox>::adaptiveAreaLight(const ray &r, const point &isection, mvector &norm,
+														const material &mat, s_light *sl, const sphericalrect *seen,
+														RGB &ret) {
+	for (int p = 0; p < sSampleSq; p++)
+		for (int q = 0; q < sSampleSq; q++) {
+			if (seen)
+				sl->getSample(lightSamples[p*sSampleSq + q], *seen, p, q, sSampleSq, random);
+			else
+				sl->getSample(lightSamples[p*sSampleSq + q], p, q, sSampleSq, random);
+		}
+
+	int coarse = 0, lit = 0;
+	for (int p = 0; p < sSampleSq; p++)
+		for (int q = 0; q < sSampleSq; q++) {
+			if (!coarseStratum[p] || !coarseStratum[q])
+				continue;
+			int k = p*sSampleSq + q;
+			sampleLit[k] = shadowRayClear(ray(isection, lightSamples[k] - isection));
+			lit += sampleLit[k];
+			++coarse;
+		}
+	bool penumbra = lit > 0 && lit < coarse;
+
+	RGB temp;
+	for (int p = 0; p < sSampleSq; p++)
+		for (int q = 0; q < sSampleSq; q++) {
+			int k = p*sSampleSq + q;
+			mvector toLight = lightSamples[k] - isection;
+			ray sr(isection, toLight);
+			bool clear;
+			if (coarseStratum[p] && coarseStratum[q])
+				clear = sampleLit[k];
+			else if (penumbra)
+				clear = shadowRayClear(sr);
+			else {
+				/* Not traced, but a change along it may change the estimate */
+				if (reachBounds) {
+					extendReach(sr.p);
+					extendReach(sr.evaluate(1.0));
+				}
+				clear = lit > 0;
+			}
+			if (!clear)
+				continue;
+			RGB l_rgb = seen ? sl->getWeightedSpectralD(sr, *seen) : sl->getWeightedSpectralD(sr);
+			if (l_rgb.hasNoEnergy())
+				continue;
+			blinn_phong<kind>(r, norm, toLight, mat, l_rgb, temp);
+		}
+	temp /= (double) shadowSamples;
+	ret += temp;
 }
 
-void montecarlo::blinn_phong (const ray &r, mvector &norm, mvector &l, material *mat, RGB &l_rgb, RGB &ret) {
+/* Shading kernel for one light sample, the specular half only exists for SPECULAR materials */
+template <bool correlated, bool useBBox>
+template <material::shadingClass kind>
+void montecarlo<correlated, useBBox>::blinn_phong (const ray &r, mvector &norm, mvector &l, const material &mat,
+												   RGB &l_rgb, RGB &ret) {
 	l.normalize();
 	/* Lambertian Shading */
 	RGB lambertian = l_rgb;
 	double lamb_const =  max((double)0.0, norm * l);
 	lambertian *= lamb_const;
-	lambertian *= mat->diffuse;
+	lambertian *= mat.diffuse;
 	ret += lambertian;
 
+	if (kind != material::SPECULAR)
+		return;
+
 	/* Specular shading */
 	RGB phong = l_rgb;
 	mvector v = r.d * -1.0;
 	v.normalize();
 	mvector h = v + l;
 	h.normalize();
-	double bp_const = pow( max((double)0.0, norm * h), mat->phong_exponent);
+	double bp_const = mat.specularPower(max((double)0.0, norm * h));
 	phong *= bp_const;
-	phong *= mat->specular;
+	phong *= mat.specular;
 	ret += phong;
 }
 
 /*
- * rel_lgt is a valid light index if rt is shadow ray, else it is -1
+ * Direct light at a hit from every light, added to ret.
  * IMPORTANT!! Uses blinn_phong shading to calculate the luminescence on a ray
  * Should possible move that out if other shaders are going to be used.
  *
  * rayID is the ray's correlated location on light
  */
-RGB montecarlo::L(const ray &r, rayType rt, double min_t, double max_t, unsigned int rel_lgt, int recursionC, int rayID) {
-	if (recursionC == 0)
-		return RGB();
-
-	/* If shadow ray, rel_light is just the relevant light index */
-	if (rt == SHADOW_RAY)
-		return getLightSpectralDensity(r, min_t, max_t, rel_lgt);
-
-	/* Whatever type of ray, see if there is an intersection. Return if none */
-	intersection closest;
-	bool hasIsect = getClosestIntersection(r, min_t, max_t, closest);
-	if (!hasIsect)
-		return RGB();
+template <bool correlated, bool useBBox>
+template <material::shadingClass kind>
+void montecarlo<correlated, useBBox>::directLight(const ray &r, const point &isection, const mvector &n,
+												  const material &mat, int rayID, RGB &ret) {
+	mvector norm = n;
+	size_t pl_size = pointLights.size();
+	for (size_t s = 0; s < pl_size; ++s) {
+		p_light *lt = pointLights[s];
+		mvector l = lt->getPosition() - isection;
+		ray sr(isection, l);
+		RGB l_rgb = pointLightSpectralDensity(sr, lt);
+		if (l_rgb.hasNoEnergy())
+			continue;
+		blinn_phong<kind>(r, norm, l, mat, l_rgb, ret);
+	}
 
-	/* We have an intersection. closest has been populated */
-	point isection = r.evaluate(closest.t);
-	closest.n.normalize();
-	material *mat = objs.materials[closest.mat];
-	RGB ret;
-	/*
-	 * Want to change normal if we hit the backside of a surface for regular rays.
-	 * Matters for triangles and planes sitting in space.
-	 */
-	mvector norm = (closest.n * r.d) >= 0.0 ? -closest.n : closest.n;
-
-	size_t lt_size = objs.lights.size();
-	for (unsigned int s = 0; s < lt_size; ++s) {
-		light *lt = objs.lights[s];
-		if (lt->getLightType() == light::POINT) {
-			mvector l = lt->getPosition() - isection;
-			ray sr(isection, l);
-			RGB l_rgb = L(sr, SHADOW_RAY, precision, 1.0, s, 1, rayID);
+	size_t al_size = areaLights.size();
+	for (size_t s = 0; s < al_size; ++s) {
+		s_light *sl = areaLights[s];
+		point sample;
+		/* A light seen edge on, or from its own plane, gives nothing */
+		sphericalrect view;
+		const sphericalrect *seen = 0;
+		if (solidAngleLights) {
+			view = sl->seenFrom(isection);
+			if (!(view.solidAngle > 0.0))
+				continue;
+			seen = &view;
+		}
+		if (correlated) {
+			int correlatedShadow = correlatedShadows[rayID];
+			int p = correlatedShadow/pSampleSq;
+			int q = correlatedShadow%pSampleSq;
+			if (seen)
+				sl->getSample(sample, *seen, p, q, pSampleSq, random);
+			else
+				sl->getSample(sample, p, q, pSampleSq, random);
+			mvector toLight = sample - isection;
+			ray sr(isection, toLight);
+			RGB l_rgb = areaLightSpectralDensity(sr, sl, seen);
 			if (l_rgb.hasNoEnergy())
 				continue;
-			blinn_phong(r, norm, l, mat, l_rgb, ret);
+			blinn_phong<kind>(r, norm, toLight, mat, l_rgb, ret);
+		} else if (adaptiveShadows) {
+			adaptiveAreaLight<kind>(r, isection, norm, mat, sl, seen, ret);
+		} else {
+			RGB temp;
+			for (int p = 0; p < sSampleSq; p++)
+				for (int q = 0; q < sSampleSq; q++) {
+					if (seen)
+						sl->getSample(sample, *seen, p, q, sSampleSq, random);
+					else
+						sl->getSample(sample, p, q, sSampleSq, random);
+					mvector toLight = sample - isection;
+					ray sr(isection, toLight);
+					RGB l_rgb = areaLightSpectralDensity(sr, sl, seen);
+					if (l_rgb.hasNoEnergy())
+						continue;
+					blinn_phong<kind>(r, norm, toLight, mat, l_rgb, temp);
+				}
+			temp /= (double) shadowSamples;
+			ret += temp;
 		}
-		else {
-			/* Area Light */
-			s_light *sl = static_cast<s_light*>(lt);
-			point sample;
-			if (singleShadowRay && !singlePrimaryRay) {
-				int correlatedShadow = correlatedShadows[rayID];
-				int p = correlatedShadow/pSampleSq;
-				int q = correlatedShadow%pSampleSq;
-				sl->getSample(sample, p, q, pSampleSq);
-				mvector toLight = sample - isection;
-				ray sr(isection, toLight);
-				RGB l_rgb = L(sr, SHADOW_RAY, precision, 1.0, s, 1, rayID);
-				if (l_rgb.hasNoEnergy())
-					continue;
-				blinn_phong(r, norm, toLight, mat, l_rgb, ret);
-			} else {
-				RGB temp;
-				for (int p = 0; p < sSampleSq; p++)
-					for (int q = 0; q < sSampleSq; q++) {
-						sl->getSample(sample, p, q, sSampleSq);
-						mvector toLight = sample - isection;
-						ray sr(isection, toLight);
-						RGB l_rgb = L(sr, SHADOW_RAY, precision, 1.0, s, 1, rayID);
-						if (l_rgb.hasNoEnergy())
-							continue;
-						blinn_phong (r, norm, toLight, mat, l_rgb, temp);
-					}
-				temp /= (double) shadowSamples;
-				ret += temp;
+	}
+}
+
+/*
+ * Radiance along a camera ray, following ideal reflections iteratively.
+ * throughput is the product of the reflectances along the path so far;
+ * each bounce's direct light is scaled by it. The path ends at maxDepth,
+ * on a miss or a non reflective surface, once throughput is negligible,
+ * or (with Russian roulette) by chance, in which case the surviving
+ * paths are divided by their survival probability to stay unbiased.
+ * If cached is set, the camera ray's hit is recorded there, or with
+ * replay taken from there.
+ */
+template <bool correlated, bool useBBox>
+RGB montecarlo<correlated, useBBox>::L(const ray &viewing, int rayID, primaryhit *cached) {
+	RGB ret;
+	RGB throughput(1.0, 1.0, 1.0);
+	ray r = viewing;
+	double min_t = 0.0;
+
+	for (int depth = 0; depth < maxDepth; ++depth) {
+		/* See if there is an intersection. Done if none */
+		intersection closest = intersection();
+		if (depth == 0 && replay) {
+			/* Relighting, an earlier render found the camera ray's hit */
+			if (cached->surface < 0) {
+				if (reachBounds)
+					escapeReach(r);
+				break;
+			}
+			closest.t = cached->t;
+			closest.n = cached->n;
+			closest.mat = objs.surfaces[cached->surface]->mat;
+		} else {
+			++rays;
+			int which = -1;
+			bool hit = getClosestIntersection(r, min_t, infinity, closest, which, depth == 0 ? &tileSurfaces : 0);
+			if (depth == 0 && cached) {
+				cached->t = closest.t;
+				cached->n = closest.n;
+				cached->surface = which;
+			}
+			if (!hit) {
+				if (reachBounds)
+					escapeReach(r);
+				break;
 			}
 		}
-	}
 
-	/* Add ambient if camera ray and we have an intersection */
-	if (rt == VIEWING_RAY) {
-		RGB ambient = objs.al.intensity();
-		ambient *= mat->diffuse;
-		ret += ambient;
-	}
+		/* Surfaces hand back unit normals, no need to normalize again */
+		point isection = r.evaluate(closest.t);
+		if (reachBounds) {
+			extendReach(r.p);
+			extendReach(isection);
+		}
+		const material &mat = objs.materials[closest.mat];
+		/*
+		 * Want to change normal if we hit the backside of a surface for regular rays.
+		 * Matters for triangles and planes sitting in space.
+		 */
+		mvector norm = (closest.n * r.d) >= 0.0 ? -closest.n : closest.n;
 
-	/* Add reflections if we have reflective */
-	if (mat->ideal_reflective.hasNoEnergy())
-		return ret;
-	RGB reflective = mat->ideal_reflective;
-	mvector reflect_direction = r.d + norm*((r.d * norm)*-2.0);
-	ray reflected(isection, reflect_direction);
-	return ret +=
-			(reflective *=
-					L(reflected, REFLECTION_RAY, precision, infinity, -1, recursionC-1, rayID));
+		RGB local;
+		/* Mirrors get no direct light, so they fire no shadow rays */
+		switch (mat.kind) {
+		case material::SPECULAR:
+			directLight<material::SPECULAR>(r, isection, norm, mat, rayID, local);
+			break;
+		case material::DIFFUSE:
+			directLight<material::DIFFUSE>(r, isection, norm, mat, rayID, local);
+			break;
+		case material::MIRROR:
+			break;
+		}
+		/* Add ambient if camera ray and we have an intersection */
+		if (depth == 0) {
+			RGB ambient = objs.al.intensity();
+			ambient *= mat.diffuse;
+			local += ambient;
+		}
+		local *= throughput;
+		ret += local;
+
+		/* Continue along the reflection if we have reflective */
+		if (mat.ideal_reflective.hasNoEnergy())
+			break;
+		throughput *= mat.ideal_reflective;
+		double strongest = max(max(throughput.r, throughput.g), throughput.b);
+		if (russianRoulette && depth + 1 >= rouletteDepth) {
+			/* Survive with the probability of the strongest channel */
+			if (strongest < 1.0) {
+				if (random.uniform() >= strongest)
+					break;
+				throughput /= strongest;
+			}
+		} else if (strongest < minThroughput)
+			break;
+
+		r = ray(isection, r.d + norm*((r.d * norm)*-2.0));
+		min_t = precision;
+	}
+	return ret;
 }
 
-void montecarlo::setPixel(Rgba &pixel, int i, int j) {
-	if (singleShadowRay && !singlePrimaryRay)
-		createMapping();
+/*
+ * Averages samples [firstSample, lastSample) of pixel i, j. The random
+ * stream is reseeded for each sample, see random.h.
+ */
+template <bool correlated, bool useBBox>
+void montecarlo<correlated, useBBox>::setPixel(fpixel &pixel, int i, int j) {
+	unsigned long long pixelID = (unsigned long long) j * caminfo.nx + i;
+	if (correlated)
+		createMapping(pixelID);
 
+	primaryhit *pixelHits = hits ? hits + pixelID * pixelSamples : 0;
 	RGB irradiance;
-	for (int p = 0; p < pSampleSq; p++)
-		for (int q = 0; q < pSampleSq; q++) {
-			ray viewing = getRay(i, j, p, q);
-			irradiance += L(viewing, VIEWING_RAY, 0.0, infinity, -1, recursionLimit, p*pSampleSq+q);
-		}
-	irradiance /= (double) pixelSamples;
+	for (int s = firstSample; s < lastSample; s++) {
+		int p = s / pSampleSq;
+		int q = s % pSampleSq;
+		random.seed(rng::mix(seed, pixelID, s));
+		ray viewing = getRay(i, j, p, q);
+		irradiance += L(viewing, s, pixelHits ? pixelHits + s : 0);
+	}
+	irradiance /= (double) (lastSample - firstSample);
 
 	pixel.r = irradiance.r;
 	pixel.g = irradiance.g;
@@ -0,0 +1,35 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+/*
+ * Morton (Z order) codes interleave the bits of grid coordinates, so
+ * cells close in the grid mostly get close codes. Used to order faces,
+ * surfaces and pixels so that what is used together sits together.
+ */
+
+/* The low 10 bits of x, spread out to every third bit */
+inline unsigned int spreadBits3 (unsigned int x) {
+	x &= 0x3ff;
+	x = (x | x << 16) & 0x030000ff;
+	x = (x | x << 8) & 0x0300f00f;
+	x = (x | x << 4) & 0x030c30c3;
+	x = (x | x << 2) & 0x09249249;
+	return x;
+}
+
+/* Cell x, y, z of a 1024^3 grid */
+inline unsigned int mortonCode3 (unsigned int x, unsigned int y, unsigned int z) {
+	return spreadBits3(x) | spreadBits3(y) << 1 | spreadBits3(z) << 2;
+}
+
+/* Every second bit of code, packed together; the x of a 2D code, or y of code >> 1 */
+inline unsigned int compactBits2 (unsigned int code) {
+	code &= 0x55555555;
+	code = (code | code >> 1) & 0x33333333;
+	code = (code | code >> 2) & 0x0f0f0f0f;
+	code = (code | code >> 4) & 0x00ff00ff;
+	code = (code | code >> 8) & 0x0000ffff;
+	return code;
+}
+
+#endif
@@ -0,0 +1,159 @@
+#include "perfcounters.h"
+#include <cstring>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+using namespace std;
+
+static const char *eventNames[] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+static const char *phaseNames[] = {"load", "render", "write"};
+static const unsigned long long eventConfigs[] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+const unsigned long long perfcounters::unavailable;
+
+perfcounters::perfcounters (bool enabled, int thread) {
+	this->thread = thread;
+	memset(started, 0, sizeof(started));
+	find("main");
+	for (int e = 0; e < NUM_EVENTS; ++e) {
+		fds[e] = -1;
+		if (!enabled)
+			continue;
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = eventConfigs[e];
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		/* User space only, so this works at perf_event_paranoid 2 */
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		/* pid 0, cpu -1: this thread, on whatever cpu it runs */
+		fds[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+}
+
+perfcounters::~perfcounters () {
+	for (int e = 0; e < NUM_EVENTS; ++e)
+		if (fds[e] >= 0)
+			close(fds[e]);
+}
+
+bool perfcounters::available () const {
+	for (int e = 0; e < NUM_EVENTS; ++e)
+		if (fds[e] >= 0)
+			return true;
+	return false;
+}
+
+/* Counter value scaled up for the time it was multiplexed out */
+unsigned long long perfcounters::readCounter (int e) const {
+	unsigned long long buf[3];
+	if (fds[e] < 0 || read(fds[e], buf, sizeof(buf)) != sizeof(buf))
+		return 0;
+	if (buf[2] == 0)
+		return 0;
+	if (buf[2] < buf[1])
+		return (unsigned long long) ((double) buf[0] * buf[1] / buf[2]);
+	return buf[0];
+}
+
+perfcounters::row& perfcounters::find (const string &label) {
+	for (size_t r = 0; r < rows.size(); ++r)
+		if (rows[r].label == label)
+			return rows[r];
+	rows.push_back(row());
+	row &added = rows.back();
+	added.label = label;
+	memset(added.totals, 0, sizeof(added.totals));
+	memset(added.counted, 0, sizeof(added.counted));
+	memset(added.measured, 0, sizeof(added.measured));
+	return added;
+}
+
+void perfcounters::begin (phase p) {
+	for (int e = 0; e < NUM_EVENTS; ++e)
+		started[e] = readCounter(e);
+	rows[0].measured[p] = true;
+}
+
+void perfcounters::end (phase p) {
+	for (int e = 0; e < NUM_EVENTS; ++e) {
+		rows[0].totals[p][e] += readCounter(e) - started[e];
+		rows[0].counted[p][e] = fds[e] >= 0;
+	}
+}
+
+void perfcounters::counts (unsigned long long *out) const {
+	for (int e = 0; e < NUM_EVENTS; ++e)
+		out[e] = fds[e] >= 0 ? readCounter(e) : unavailable;
+}
+
+void perfcounters::add (phase p, const string &who, const unsigned long long *counts) {
+	row &r = find(who);
+	r.measured[p] = true;
+	for (int e = 0; e < NUM_EVENTS; ++e)
+		if (counts[e] != unavailable) {
+			r.totals[p][e] += counts[e];
+			r.counted[p][e] = true;
+		}
+}
+
+void perfcounters::printRow (ostream &out, int p, const string &label, const unsigned long long *t,
+							 const bool *counted) const {
+	out << setw(8) << phaseNames[p] << setw(12) << label;
+	for (int e = 0; e < NUM_EVENTS; ++e) {
+		if (!counted[e])
+			out << setw(16) << "n/a";
+		else
+			out << setw(16) << t[e];
+	}
+	streamsize prec = out.precision();
+	out << fixed << setprecision(2);
+	if (counted[CYCLES] && counted[INSTRUCTIONS] && t[CYCLES])
+		out << setw(8) << (double) t[INSTRUCTIONS] / t[CYCLES];
+	else
+		out << setw(8) << "n/a";
+	if (counted[INSTRUCTIONS] && counted[CACHE_MISSES] && t[INSTRUCTIONS])
+		out << setw(12) << 1000.0 * t[CACHE_MISSES] / t[INSTRUCTIONS];
+	else
+		out << setw(12) << "n/a";
+	out.unsetf(ios::floatfield);
+	out.precision(prec);
+	out << endl;
+}
+
+void perfcounters::report (ostream &out) const {
+	if (!available()) {
+		out << "Performance counters unavailable (perf_event_open failed, "
+			<< "check /proc/sys/kernel/perf_event_paranoid)" << endl;
+		return;
+	}
+	out << "Performance counters, thread " << thread << " as main and the threads and workers it started:" << endl;
+	out << setw(8) << "phase" << setw(12) << "thread";
+	for (int e = 0; e < NUM_EVENTS; ++e)
+		out << setw(16) << eventNames[e];
+	out << setw(8) << "IPC" << setw(12) << "cache MPKI" << endl;
+	for (int p = 0; p < NUM_PHASES; ++p) {
+		unsigned long long total[NUM_EVENTS] = {0};
+		bool counted[NUM_EVENTS] = {false};
+		int shown = 0;
+		for (size_t r = 0; r < rows.size(); ++r) {
+			if (!rows[r].measured[p])
+				continue;
+			printRow(out, p, rows[r].label, rows[r].totals[p], rows[r].counted[p]);
+			++shown;
+			for (int e = 0; e < NUM_EVENTS; ++e)
+				if (rows[r].counted[p][e]) {
+					total[e] += rows[r].totals[p][e];
+					counted[e] = true;
+				}
+		}
+		if (shown > 1)
+			printRow(out, p, "total", total, counted);
+	}
+}
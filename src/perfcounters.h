@@ -0,0 +1,55 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Hardware performance counters for the calling thread only, via Linux
+ * perf_event_open. Each render phase is bracketed with begin/end and the
+ * deltas are accumulated per phase. Threads and worker processes open
+ * their own, and their counts are added to a phase as rows of their own,
+ * so the report shows how the work spread over them as well as the total.
+ * Every event is opened on its own, so a machine that lacks one counter
+ * (common in VMs) still reports the rest; if none can be opened the
+ * report just says so.
+ */
+class perfcounters {
+	public:
+		enum event {CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, NUM_EVENTS};
+		enum phase {LOAD, RENDER, WRITE, NUM_PHASES};
+		/* In counts for an event that could not be opened */
+		static const unsigned long long unavailable = ~0ULL;
+		/* If not enabled no counters are opened and begin/end do nothing */
+		perfcounters (bool enabled, int thread);
+		~perfcounters ();
+		void begin (phase p);
+		void end (phase p);
+		/* Events counted since the counters opened, for another thread's add */
+		void counts (unsigned long long *out) const;
+		/* Adds another thread's counts to phase p, on the row labelled who */
+		void add (phase p, const std::string &who, const unsigned long long *counts);
+		bool available () const;
+		void report (std::ostream &out) const;
+
+	private:
+		/* Counts of this thread, then one per label added */
+		class row {
+			public:
+				std::string label;
+				unsigned long long totals[NUM_PHASES][NUM_EVENTS];
+				bool counted[NUM_PHASES][NUM_EVENTS];
+				bool measured[NUM_PHASES];
+		};
+		int thread;
+		int fds[NUM_EVENTS];
+		unsigned long long started[NUM_EVENTS];
+		std::vector<row> rows;
+		unsigned long long readCounter (int e) const;
+		row& find (const std::string &label);
+		void printRow (std::ostream &out, int p, const std::string &label, const unsigned long long *t,
+					   const bool *counted) const;
+};
+
+#endif
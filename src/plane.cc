@@ -1,4 +1,6 @@
 #include "plane.h"
+#include "arena.h"
+#include <new>
 
 plane::plane (mvector &norm, double dist)  {
 	n = norm;
@@ -6,7 +8,7 @@ plane::plane (mvector &norm, double dist)  {
 	n.normalize();
 }
 
-bool plane::intersect (const ray &r, double start, double end, intersection &info, bool useBBox) {
+bool plane::intersect (const ray &r, double start, double end, intersection &info) {
 	double dn = r.d * n;
 	if (dn == 0.0)
 		return false;
@@ -19,6 +21,14 @@ bool plane::intersect (const ray &r, double start, double end, intersection &inf
 	return true;
 }
 
+surface* plane::relocate (void *slot) const {
+	return new (slot) plane(*this);
+}
+
+void plane::translate (const mvector &delta) {
+	d -= n * delta;
+}
+
 plane::~plane() {
 
 }
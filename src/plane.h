@@ -9,7 +9,22 @@ class plane : public surface {
 		mvector n;
 		double d;
 		plane (mvector &norm, double dist);
-		virtual bool intersect (const ray &r, double start, double end, intersection &info, bool useBBox);
+		virtual bool intersect (const ray &r, double start, double end, intersection &info);
+		/* Points on the plane satisfy p*n + d = 0 */
+		void translate (const mvector &delta);
+		void hash (contenthash &h) const {
+			h.add('p');
+			h.add(n);
+			h.add(d);
+		}
+		bool bounded () const {
+			return false;
+		}
+		/* Planes are unbounded, the preview shows the plane itself */
+		virtual bool intersectBBox (const ray &r, double start, double end, intersection &info) {
+			return intersect(r, start, end, info);
+		}
+		surface* relocate (void *slot) const;
 		virtual ~plane();
 };
 
@@ -0,0 +1,198 @@
+#include "quantizedmesh.h"
+#include "triangle.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+using namespace std;
+
+static void putVarint (vector<unsigned char> &out, int delta) {
+	unsigned int z = (unsigned int) ((delta << 1) ^ (delta >> 31));
+	while (z >= 0x80) {
+		out.push_back((unsigned char) (z | 0x80));
+		z >>= 7;
+	}
+	out.push_back((unsigned char) z);
+}
+
+static inline int getVarint (const unsigned char *&in) {
+	unsigned int z = 0;
+	int shift = 0;
+	unsigned char c;
+	do {
+		c = *in++;
+		z |= (unsigned int) (c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return (int) (z >> 1) ^ -(int) (z & 1);
+}
+
+static inline double signNotZero (double v) {
+	return v < 0.0 ? -1.0 : 1.0;
+}
+
+/* Unit vector onto the octahedron, folded into the square [-1, 1]^2 */
+static void encodeNormal (const mvector &n, short *out) {
+	double l1 = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	double x = n.x / l1, y = n.y / l1;
+	if (n.z < 0.0) {
+		double fx = (1.0 - fabs(y)) * signNotZero(x);
+		double fy = (1.0 - fabs(x)) * signNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	out[0] = (short) floor(x * 32767.0 + 0.5);
+	out[1] = (short) floor(y * 32767.0 + 0.5);
+}
+
+quantizedmesh::quantizedmesh (const vector<int> &tris, const vector<double> &verts, int b, arena &store) {
+	bits = b == 21 ? 21 : 16;
+	vertexCount = verts.size() / 3;
+	triangleCount = tris.size() / 3;
+	blockCount = (triangleCount + blockSize - 1) / blockSize;
+
+	double inf = numeric_limits<double>::infinity();
+	point lo(inf, inf, inf), hi(-inf, -inf, -inf);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		lo = point(min(lo.x, verts[3*v]), min(lo.y, verts[3*v + 1]), min(lo.z, verts[3*v + 2]));
+		hi = point(max(hi.x, verts[3*v]), max(hi.y, verts[3*v + 1]), max(hi.z, verts[3*v + 2]));
+	}
+	double levels = (double) ((1 << bits) - 1);
+	origin = vertexCount ? lo : point();
+	step = vertexCount ? mvector((hi.x - lo.x) / levels, (hi.y - lo.y) / levels, (hi.z - lo.z) / levels) : mvector();
+
+	q16 = 0;
+	q21 = 0;
+	if (bits == 16)
+		q16 = static_cast<unsigned short*>(store.allocate(sizeof(unsigned short) * 3 * vertexCount));
+	else
+		q21 = static_cast<unsigned long long*>(store.allocate(sizeof(unsigned long long) * vertexCount));
+	const double *o = &origin.x, *s = &step.x;
+	for (size_t v = 0; v < vertexCount; ++v) {
+		unsigned long long q[3];
+		for (int a = 0; a < 3; ++a)
+			q[a] = s[a] > 0.0 ? (unsigned long long) floor((verts[3*v + a] - o[a]) / s[a] + 0.5) : 0;
+		if (q16) {
+			q16[3*v] = (unsigned short) q[0];
+			q16[3*v + 1] = (unsigned short) q[1];
+			q16[3*v + 2] = (unsigned short) q[2];
+		} else
+			q21[v] = q[0] | q[1] << 21 | q[2] << 42;
+	}
+
+	/* Indices and block boxes, normals from the original positions */
+	vector<unsigned char> packed;
+	normals = static_cast<short*>(store.allocate(sizeof(short) * 2 * triangleCount));
+	blocks = static_cast<meshblock*>(store.allocate(sizeof(meshblock) * blockCount));
+	lo = point(inf, inf, inf);
+	hi = point(-inf, -inf, -inf);
+	for (size_t bl = 0; bl < blockCount; ++bl) {
+		size_t first = bl * blockSize, last = min(first + blockSize, triangleCount);
+		point blo(inf, inf, inf), bhi(-inf, -inf, -inf);
+		int prev = 0;
+		blocks[bl].indexOffset = packed.size();
+		for (size_t t = first; t < last; ++t) {
+			for (int k = 0; k < 3; ++k) {
+				int v = tris[3*t + k];
+				putVarint(packed, v - prev);
+				prev = v;
+				point p = vertex(v);
+				blo = point(min(blo.x, p.x), min(blo.y, p.y), min(blo.z, p.z));
+				bhi = point(max(bhi.x, p.x), max(bhi.y, p.y), max(bhi.z, p.z));
+			}
+			const double *p1 = &verts[3*tris[3*t]], *p2 = &verts[3*tris[3*t + 1]], *p3 = &verts[3*tris[3*t + 2]];
+			mvector n = mvector(p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2]).cross(
+						mvector(p3[0] - p1[0], p3[1] - p1[1], p3[2] - p1[2]));
+			/* As in triangle, one with no area is never hit */
+			if (n * n != 0.0)
+				n.normalize();
+			encodeNormal(n, normals + 2*t);
+		}
+		/* bbox pushes the box out, so hits on its faces are kept */
+		blocks[bl].box = bbox(blo, bhi);
+		lo = point(min(lo.x, blo.x), min(lo.y, blo.y), min(lo.z, blo.z));
+		hi = point(max(hi.x, bhi.x), max(hi.y, bhi.y), max(hi.z, bhi.z));
+	}
+	box = bbox(lo, hi);
+	indexBytes = packed.size();
+	indices = static_cast<unsigned char*>(store.allocate(indexBytes));
+	if (indexBytes)
+		memcpy(indices, &packed[0], indexBytes);
+}
+
+point quantizedmesh::vertex (int v) const {
+	if (q16)
+		return point(origin.x + q16[3*v] * step.x, origin.y + q16[3*v + 1] * step.y, origin.z + q16[3*v + 2] * step.z);
+	unsigned long long q = q21[v];
+	const unsigned long long mask = (1 << 21) - 1;
+	return point(origin.x + (q & mask) * step.x, origin.y + (q >> 21 & mask) * step.y,
+				 origin.z + (q >> 42 & mask) * step.z);
+}
+
+mvector quantizedmesh::normal (size_t t) const {
+	double x = normals[2*t] / 32767.0, y = normals[2*t + 1] / 32767.0;
+	double z = 1.0 - fabs(x) - fabs(y);
+	if (z < 0.0) {
+		double fx = (1.0 - fabs(y)) * signNotZero(x);
+		double fy = (1.0 - fabs(x)) * signNotZero(y);
+		x = fx;
+		y = fy;
+	}
+	mvector n(x, y, z);
+	n.normalize();
+	return n;
+}
+
+/* Closest hit over the blocks the ray reaches, ties to the first triangle like the scene loop */
+bool quantizedmesh::intersect (const ray &r, double start, double end, intersection &info) {
+	if (!box.overlaps(r, start, end))
+		return false;
+	double t;
+	size_t hitTriangle = triangleCount;
+	for (size_t bl = 0; bl < blockCount; ++bl) {
+		if (!blocks[bl].box.overlaps(r, start, end))
+			continue;
+		const unsigned char *in = indices + blocks[bl].indexOffset;
+		size_t first = bl * blockSize, last = min(first + blockSize, triangleCount);
+		int prev = 0;
+		for (size_t tri = first; tri < last; ++tri) {
+			int v1 = prev += getVarint(in);
+			int v2 = prev += getVarint(in);
+			int v3 = prev += getVarint(in);
+			if (triangle::solve(vertex(v1), vertex(v2), vertex(v3), r, start, end, t)) {
+				end = t;
+				hitTriangle = tri;
+			}
+		}
+	}
+	if (hitTriangle == triangleCount)
+		return false;
+	info.t = end;
+	info.n = normal(hitTriangle);
+	info.mat = mat;
+	return true;
+}
+
+void quantizedmesh::translate (const mvector &delta) {
+	origin += delta;
+	box.translate(delta);
+	for (size_t bl = 0; bl < blockCount; ++bl)
+		blocks[bl].box.translate(delta);
+}
+
+void quantizedmesh::hash (contenthash &h) const {
+	h.add('q');
+	h.add(bits);
+	h.add(origin);
+	h.add(step);
+	if (q16)
+		h.add(q16, sizeof(unsigned short) * 3 * vertexCount);
+	else
+		h.add(q21, sizeof(unsigned long long) * vertexCount);
+	h.add(indices, indexBytes);
+	h.add(normals, sizeof(short) * 2 * triangleCount);
+}
+
+size_t quantizedmesh::bytes () const {
+	size_t positions = q16 ? sizeof(unsigned short) * 3 * vertexCount : sizeof(unsigned long long) * vertexCount;
+	return positions + indexBytes + sizeof(short) * 2 * triangleCount + sizeof(meshblock) * blockCount;
+}
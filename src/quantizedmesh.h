@@ -0,0 +1,59 @@
+#ifndef QUANTIZEDMESH_H
+#define QUANTIZEDMESH_H
+
+#include <vector>
+#include <cstddef>
+#include "surface.h"
+#include "arena.h"
+
+/*
+ * A whole OBJ mesh in compressed form, one surface instead of a triangle
+ * per face (the w directive with sceneobjects::quantizeBits set).
+ *
+ *   positions  quantized to 16 bits per axis (6 bytes a vertex) or 21
+ *              (8 bytes) over the mesh bounds
+ *   indices    zigzag deltas from the previous index as varints, restarting
+ *              every block of triangles so blocks decode on their own
+ *   normals    octahedral, two 16 bit values
+ *
+ * Each block of triangles keeps a box around its quantized vertices, so
+ * rays test the box and decode only the blocks they may hit; triangles
+ * are intersected at their quantized positions and nothing inside a box
+ * is missed. All arrays live in the scene arena. A mesh of connected
+ * triangles takes about 15 bytes a triangle, against ~160 for triangle.
+ */
+class quantizedmesh : public surface {
+	public:
+		/* tris are zero based indices into verts, x y z triples, as readWavefrontFile gives them */
+		quantizedmesh (const std::vector<int> &tris, const std::vector<double> &verts, int bits, arena &store);
+		bool intersect (const ray &r, double start, double end, intersection &info);
+		void translate (const mvector &delta);
+		void hash (contenthash &h) const;
+		size_t triangles () const {
+			return triangleCount;
+		}
+		/* Compressed size, blocks included */
+		size_t bytes () const;
+
+	private:
+		static const size_t blockSize = 32;
+		struct meshblock {
+			bbox box;
+			size_t indexOffset;
+		};
+		int bits;
+		/* Vertex q is at origin + q*step per axis */
+		point origin;
+		mvector step;
+		size_t vertexCount, triangleCount, blockCount, indexBytes;
+		unsigned short *q16;
+		unsigned long long *q21;
+		unsigned char *indices;
+		short *normals;
+		meshblock *blocks;
+
+		inline point vertex (int v) const;
+		mvector normal (size_t triangle) const;
+};
+
+#endif
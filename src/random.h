@@ -0,0 +1,41 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+/*
+ * Small seedable generator (splitmix64). The integrator reseeds it for
+ * every sample from (seed, pixel, sample index), so a sample's random
+ * numbers do not depend on which other pixels or samples were rendered
+ * before it. That is what lets a frame be split across processes and
+ * merged back into the same image.
+ */
+class rng {
+	public:
+		rng (unsigned long long s = 0) : state(s) {}
+		void seed (unsigned long long s) {
+			state = s;
+		}
+		/* Seed for one stream, from a render seed and two indices */
+		static unsigned long long mix (unsigned long long seed, unsigned long long a, unsigned long long b) {
+			rng r(seed ^ (a * 0x9E3779B97F4A7C15ULL));
+			r.state ^= r.next() + b;
+			return r.next();
+		}
+		unsigned long long next () {
+			unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			return z ^ (z >> 31);
+		}
+		/* Uniform in [0, 1) */
+		double uniform () {
+			return (next() >> 11) * (1.0/9007199254740992.0);
+		}
+		/* Uniform integer in [0, n) */
+		unsigned int below (unsigned int n) {
+			return (unsigned int) (uniform() * n);
+		}
+	private:
+		unsigned long long state;
+};
+
+#endif
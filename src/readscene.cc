@@ -1,44 +1,43 @@
 #include <cmath>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cstring>
 #include <string>
 #include <cstdlib>
 #include <vector>
-#include <cassert>
+#include <deque>
+#include <limits>
+#include <algorithm>
+#include <map>
+#include <typeinfo>
+#include <pthread.h>
+#include <unistd.h>
 #include "readscene.h"
 #include "sphere.h"
 #include "plane.h"
 #include "triangle.h"
+#include "meshproxy.h"
+#include "quantizedmesh.h"
+#include "lodmesh.h"
+#include "spherecloud.h"
+#include "morton.h"
 #include "camera.h"
 #include "basic_constructs.h"
+#include "perfcounters.h"
 
 using namespace std;
 
-int getMaterialIndex (vector<material*> &mats, double dr, double dg, double db, double sr, double sg, double sb,
-					  double r, double ir, double ig, double ib) {
-	int i = 0;
-	for (vector<material*>::iterator iter = mats.begin(); iter != mats.end(); ++iter, ++i)
-		if ((*iter)->isSame(dr, dg, db, sr, sg, sb, r, ir, ig, ib))
-			break;
-
-	if ((size_t)i != mats.size())
-		return i;
-
-	mats.push_back(new material(dr, dg, db, sr, sg, sb, r, ir, ig, ib));
-	return i;
-}
-
-const char* getFileName (string inString) {
+// Empty if the line names no file
+string getFileName (string inString) {
 	unsigned int i = 1;
 	while (i < inString.size()) {
 		if (inString[i] != ' ')
 			break;
 		i++;
 	}
-	assert(i < inString.size());
 
-	return inString.substr(i).c_str();
+	return i < inString.size() ? inString.substr(i) : "";
 }
 
 double getTokenAsFloat (string inString, int whichToken) {
@@ -76,6 +75,18 @@ double getTokenAsFloat (string inString, int whichToken) {
     return thisFloatVal;
 }
 
+// Like getTokenAsFloat, but for optional trailing words: returns an
+// empty string when the line has no such token.
+string getTokenAsString (string inString, int whichToken) {
+    istringstream in (inString);
+    string token;
+    for (int i = 0; i <= whichToken; i++) {
+        if (!(in >> token))
+            return "";
+    }
+    return token;
+}
+
 // Given the name of a wavefront (OBJ) file that consists JUST of
 // vertices, triangles, and comments, read it into the tris and verts
 // vectors.
@@ -89,12 +100,20 @@ double getTokenAsFloat (string inString, int whichToken) {
 // If you are using the supplied Parser class, you should probably make this
 // a method on it: Parser::read_wavefront_file().
 //
-void readWavefrontFile (const char *file, std::vector< int > &tris, std::vector< double > &verts)
+// Returns false with the reason in error if the file can't be opened or
+// a face names a vertex the file doesn't have.
+//
+bool readWavefrontFile (const char *file, std::vector< int > &tris, std::vector< double > &verts,
+                        string &error)
 {
     tris.clear ();
     verts.clear ();
 
     ifstream in(file);
+    if (!in.is_open()) {
+        error = string("can't open mesh ") + file;
+        return false;
+    }
     char buffer[1025];
     string cmd;
 
@@ -127,8 +146,8 @@ void readWavefrontFile (const char *file, std::vector< int > &tris, std::vector<
         else if (cmd=="f") {
             // got a face (triangle)
 
-            // read in the parameters:
-            int i, j, k;
+            // read in the parameters, a short line leaves index 0 and fails below:
+            int i = 0, j = 0, k = 0;
             iss >> i >> j >> k;
 
             // vertex numbers in OBJ files start with 1, but in C++ array
@@ -145,23 +164,408 @@ void readWavefrontFile (const char *file, std::vector< int > &tris, std::vector<
     in.close();
 
  //std::cout << "found this many tris, verts: " << tris.size () / 3.0 << "  " << verts.size () / 3.0 << std::endl;
+
+    int vertices = (int) (verts.size () / 3);
+    for (size_t t = 0; t < tris.size (); t++)
+        if (tris[t] < 0 || tris[t] >= vertices) {
+            ostringstream bad;
+            bad << file << ": face " << t / 3 + 1 << " names vertex " << tris[t] + 1 << " of " << vertices;
+            error = bad.str ();
+            return false;
+        }
+    return true;
+}
+
+// Adds s to the scene, and to group unless that is empty
+static void addSurface (sceneobjects &sObjects, surface *s, const string &group) {
+	sObjects.surfaces.push_back(s);
+	if (!group.empty())
+		sObjects.groups[group].push_back(s);
+}
+
+// One w directive. The OBJ is read on its own thread while the scene
+// file is parsed on; its triangles are built once every file is in.
+class objload {
+	public:
+		string file;
+		int material;
+		string group;
+		// Surfaces ahead of it, so its triangles keep their place in the scene
+		size_t position;
+		vector<int> tris;
+		vector<double> verts;
+		// tris.size()/3 triangles, one block in the arena
+		triangle *built;
+		// Bits per axis to keep the mesh as one quantizedmesh, 0 for triangles
+		int quantizeBits;
+		// Whether a large mesh becomes a lodmesh
+		bool lod;
+		// The whole mesh as one surface, instead of built
+		surface *single;
+		bool clean;
+		meshcleanup cleaned;
+		pthread_t reader;
+		// Why the file could not be read, checked once every reader is joined
+		string error;
+		// Of the w line in the scene file
+		int line;
+		// Whether the reader counts its events into events, set when it has a thread of its own
+		bool counting;
+		unsigned long long events[perfcounters::NUM_EVENTS];
+};
+
+static void* readObjMain (void *arg) {
+	objload *job = static_cast<objload*>(arg);
+	perfcounters counters(job->counting, 0);
+	if (readWavefrontFile(job->file.c_str(), job->tris, job->verts, job->error) && job->clean)
+		job->cleaned.clean(job->tris, job->verts);
+	counters.counts(job->events);
+	return 0;
+}
+
+// Triangles [first, last) of all loads taken together, for one builder thread
+class buildrange {
+	public:
+		vector<objload*> *loads;
+		size_t first, last;
+		// As in objload
+		bool counting;
+		unsigned long long events[perfcounters::NUM_EVENTS];
+};
+
+static void* buildMain (void *arg) {
+	buildrange *range = static_cast<buildrange*>(arg);
+	perfcounters counters(range->counting, 0);
+	vector<objload*> &loads = *range->loads;
+	size_t start = 0, l = 0;
+	for (size_t k = range->first; k < range->last; ++k) {
+		while (k >= start + loads[l]->tris.size() / 3)
+			start += loads[l++]->tris.size() / 3;
+		objload *job = loads[l];
+		const vector<int> &tris = job->tris;
+		const vector<double> &verts = job->verts;
+		size_t i = 3 * (k - start);
+		int p1_i = 3*tris[i];
+		int p2_i = 3*tris[i+1];
+		int p3_i = 3*tris[i+2];
+		point p1 = point (verts[p1_i], verts[p1_i+1], verts[p1_i+2]);
+		point p2 = point (verts[p2_i], verts[p2_i+1], verts[p2_i+2]);
+		point p3 = point (verts[p3_i], verts[p3_i+1], verts[p3_i+2]);
+		triangle *tr = new (job->built + (k - start)) triangle(p1, p2, p3);
+		tr->setMaterial(job->material);
+	}
+	counters.counts(range->events);
+	return 0;
+}
+
+// Waits for every OBJ read still going and drops the loads
+static void abandonObjLoads (vector<objload*> &loads, deque<objload*> &reading) {
+	for (size_t r = 0; r < reading.size(); ++r)
+		pthread_join(reading[r]->reader, 0);
+	reading.clear();
+	for (size_t l = 0; l < loads.size(); ++l)
+		delete loads[l];
+	loads.clear();
+}
+
+// Waits for every OBJ read, builds all their triangles with one thread
+// per core and splices them into the scene where their w lines were.
+// If a file could not be read, nothing is added and error says why.
+static bool finishObjLoads (vector<objload*> &loads, deque<objload*> &reading, sceneobjects &sObjects,
+							int threads, const char *filnam, string &error) {
+	for (size_t r = 0; r < reading.size(); ++r)
+		pthread_join(reading[r]->reader, 0);
+	reading.clear();
+	for (size_t l = 0; l < loads.size(); ++l)
+		if (sObjects.perf && loads[l]->counting) {
+			// Reader l started once reader l - threads was joined, so they share a row
+			ostringstream who;
+			who << "reader " << l % threads;
+			sObjects.perf->add(perfcounters::LOAD, who.str(), loads[l]->events);
+		}
+	for (size_t l = 0; l < loads.size(); ++l)
+		if (!loads[l]->error.empty()) {
+			ostringstream where;
+			where << filnam << ":" << loads[l]->line << ": " << loads[l]->error;
+			error = where.str();
+			abandonObjLoads(loads, reading);
+			return false;
+		}
+	size_t total = 0;
+	for (size_t l = 0; l < loads.size(); ++l) {
+		objload *job = loads[l];
+		job->built = 0;
+		job->single = 0;
+		sObjects.cleaned += job->cleaned;
+		// The arena is not thread safe, so single surfaces are built here.
+		// Emptied of triangles, the builders skip over them
+		if (job->quantizeBits) {
+			job->single = new (sObjects.store) quantizedmesh(job->tris, job->verts, job->quantizeBits,
+															   sObjects.store);
+			job->single->setMaterial(job->material);
+		} else if (job->lod && job->tris.size() / 3 >= lodmesh::minTriangles) {
+			lodmesh *lm = new (sObjects.store) lodmesh(job->tris, job->verts, job->material, sObjects.store);
+			sObjects.lods.push_back(lm);
+			job->single = lm;
+		}
+		if (job->single) {
+			vector<int>().swap(job->tris);
+			vector<double>().swap(job->verts);
+			continue;
+		}
+		size_t n = job->tris.size() / 3;
+		job->built = static_cast<triangle*>(sObjects.store.allocate(sizeof(triangle) * n, n));
+		total += n;
+	}
+
+	// Small meshes are not worth the threads
+	if (total < 10000)
+		threads = 1;
+	vector<buildrange> ranges(threads);
+	vector<pthread_t> builders(threads);
+	// A range whose thread won't start is built here instead
+	vector<bool> started(threads, false);
+	for (int t = 0; t < threads; ++t) {
+		ranges[t].loads = &loads;
+		ranges[t].first = total * t / threads;
+		ranges[t].last = total * (t + 1) / threads;
+		ranges[t].counting = sObjects.perf != 0;
+		if (t > 0)
+			started[t] = pthread_create(&builders[t], 0, buildMain, &ranges[t]) == 0;
+	}
+	// Ranges built here count as this thread's
+	for (int t = 0; t < threads; ++t)
+		if (!started[t]) {
+			ranges[t].counting = false;
+			buildMain(&ranges[t]);
+		}
+	for (int t = 1; t < threads; ++t)
+		if (started[t]) {
+			pthread_join(builders[t], 0);
+			if (ranges[t].counting) {
+				ostringstream who;
+				who << "builder " << t;
+				sObjects.perf->add(perfcounters::LOAD, who.str(), ranges[t].events);
+			}
+		}
+
+	vector<surface*> merged;
+	merged.reserve(sObjects.surfaces.size() + total);
+	size_t next = 0;
+	for (size_t l = 0; l < loads.size(); ++l) {
+		objload *job = loads[l];
+		while (next < job->position)
+			merged.push_back(sObjects.surfaces[next++]);
+		if (job->single) {
+			merged.push_back(job->single);
+			if (!job->group.empty())
+				sObjects.groups[job->group].push_back(job->single);
+		}
+		size_t n = job->tris.size() / 3;
+		for (size_t t = 0; t < n; ++t) {
+			merged.push_back(job->built + t);
+			if (!job->group.empty())
+				sObjects.groups[job->group].push_back(job->built + t);
+		}
+		delete job;
+	}
+	while (next < sObjects.surfaces.size())
+		merged.push_back(sObjects.surfaces[next++]);
+	sObjects.surfaces.swap(merged);
+	loads.clear();
+	return true;
 }
 
-void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
+// Ends a run of s lines, as one spherecloud if it is at least a leaf long
+static void finishSpheres (vector<double> &spheres, int material, const string &group, sceneobjects &sObjects) {
+	if (spheres.empty())
+		return;
+	if (spheres.size() / 4 >= (size_t) spherecloud::width) {
+		spherecloud *sc = new (sObjects.store) spherecloud(spheres, sObjects.store);
+		sc->setMaterial(material);
+		addSurface(sObjects, sc, group);
+	} else
+		for (size_t s = 0; s < spheres.size(); s += 4) {
+			sphere *sp = new (sObjects.store) sphere(point(spheres[s], spheres[s + 1], spheres[s + 2]), spheres[s + 3]);
+			sp->setMaterial(material);
+			addSurface(sObjects, sp, group);
+		}
+	spheres.clear();
+}
+
+// Room for any surface that can be relocated, while its slot is refilled
+union spareslot {
+	char s[sizeof(sphere)], t[sizeof(triangle)], p[sizeof(plane)];
+	double align;
+};
+
+// A surface by the Morton code of its box center, unbounded ones first
+class surfaceorder {
+	public:
+		unsigned int code;
+		size_t index;
+		bool operator< (const surfaceorder &o) const {
+			return code != o.code ? code < o.code : index < o.index;
+		}
+};
+
+// Puts the surfaces in Morton order of their box centers, so surfaces
+// close in space sit close in the list and in the lists culled from it.
+// Those that can be relocated also trade places in the arena with others
+// of their type, so they sit close in memory in that order too, without
+// the arena growing.
+static void sortSurfaces (sceneobjects &sObjects) {
+	vector<surface*> &sfs = sObjects.surfaces;
+	double inf = numeric_limits<double>::infinity();
+	point lo(inf, inf, inf), hi(-inf, -inf, -inf);
+	for (size_t s = 0; s < sfs.size(); ++s)
+		if (sfs[s]->bounded()) {
+			const bbox &b = sfs[s]->box;
+			point c((b.min.x + b.max.x) / 2, (b.min.y + b.max.y) / 2, (b.min.z + b.max.z) / 2);
+			lo = point(min(lo.x, c.x), min(lo.y, c.y), min(lo.z, c.z));
+			hi = point(max(hi.x, c.x), max(hi.y, c.y), max(hi.z, c.z));
+		}
+	vector<surfaceorder> order(sfs.size());
+	for (size_t s = 0; s < sfs.size(); ++s) {
+		order[s].index = s;
+		order[s].code = 0;
+		if (!sfs[s]->bounded())
+			continue;
+		const bbox &b = sfs[s]->box;
+		double c[3] = {(b.min.x + b.max.x) / 2, (b.min.y + b.max.y) / 2, (b.min.z + b.max.z) / 2};
+		double l[3] = {lo.x, lo.y, lo.z}, h[3] = {hi.x, hi.y, hi.z};
+		unsigned int cell[3];
+		for (int a = 0; a < 3; ++a)
+			cell[a] = h[a] > l[a] ? (unsigned int) min(1023.0, floor((c[a] - l[a]) / (h[a] - l[a]) * 1024.0)) : 0;
+		// Past every unbounded surface
+		order[s].code = mortonCode3(cell[0], cell[1], cell[2]) + 1;
+	}
+	sort(order.begin(), order.end());
+	vector<surface*> sorted(sfs.size());
+	// Positions in the new order of each type's surfaces
+	map<string, vector<size_t> > kinds;
+	for (size_t s = 0; s < sfs.size(); ++s) {
+		sorted[s] = sfs[order[s].index];
+		kinds[typeid(*sorted[s]).name()].push_back(s);
+	}
+	sfs.swap(sorted);
+
+	spareslot spare;
+	// Old place and new place of every relocated surface
+	vector<pair<surface*, surface*> > moved;
+	for (map<string, vector<size_t> >::iterator k = kinds.begin(); k != kinds.end(); ++k) {
+		const vector<size_t> &at = k->second;
+		if (!sfs[at[0]]->relocate(&spare))
+			continue;
+		// The type's slots by address. Slot i takes the surface at[i], which
+		// is now in slot from[i]; occupant[i] is the surface now in slot i
+		size_t n = at.size();
+		vector<void*> slots(n);
+		for (size_t i = 0; i < n; ++i)
+			slots[i] = dynamic_cast<void*>(sfs[at[i]]);
+		sort(slots.begin(), slots.end());
+		vector<size_t> from(n);
+		vector<surface*> occupant(n);
+		for (size_t i = 0; i < n; ++i) {
+			from[i] = lower_bound(slots.begin(), slots.end(), dynamic_cast<void*>(sfs[at[i]])) - slots.begin();
+			occupant[from[i]] = sfs[at[i]];
+		}
+		// One cycle of the permutation at a time, the surface in its first
+		// slot waiting in spare until the cycle comes back round
+		vector<bool> filled(n, false);
+		for (size_t i = 0; i < n; ++i) {
+			if (filled[i] || from[i] == i)
+				continue;
+			surface *saved = occupant[i]->relocate(&spare);
+			for (size_t j = i; !filled[j]; j = from[j]) {
+				filled[j] = true;
+				surface *placed = (from[j] == i ? saved : occupant[from[j]])->relocate(slots[j]);
+				if (!sObjects.groups.empty())
+					moved.push_back(make_pair(sfs[at[j]], placed));
+				sfs[at[j]] = placed;
+			}
+		}
+	}
+
+	// Groups follow their surfaces
+	sort(moved.begin(), moved.end());
+	for (map<string, vector<surface*> >::iterator g = sObjects.groups.begin(); g != sObjects.groups.end(); ++g)
+		for (size_t s = 0; s < g->second.size(); ++s) {
+			vector<pair<surface*, surface*> >::iterator m =
+				lower_bound(moved.begin(), moved.end(), make_pair(g->second[s], (surface*) 0));
+			if (m != moved.end() && m->first == g->second[s])
+				g->second[s] = m->second;
+		}
+}
+
+// Tokens on a scene line as getTokenAsFloat splits them
+static int countTokens (const string &line) {
+	int n = 0;
+	bool inToken = false;
+	for (size_t i = 0; i < line.size(); ++i)
+		if (line[i] == ' ')
+			inToken = false;
+		else if (!inToken) {
+			inToken = true;
+			++n;
+		}
+	return n;
+}
+
+// Tokens a line needs, its command included, so every number it is read for is there
+static int tokensNeeded (const string &line) {
+	switch (line.empty() ? 0 : line[0]) {
+		case 's': case 'p': return 5;
+		case 't': return 10;
+		case 'c': return 12;
+		case 'm': return 11;
+		case 'l':
+			switch (line.size() > 2 ? line[2] : 0) {
+				case 'p': return 8;
+				case 's': return 15;
+				case 'a': return 5;
+			}
+	}
+	return 0;
+}
+
+static bool isZero (const mvector &v) {
+	return v * v == 0.0;
+}
+
+bool parseSceneFile (const char *filnam, sceneobjects &sObjects, string &error) {
     ifstream inFile(filnam);
     string line;
 
     if (! inFile.is_open ()) {
-        cerr << "can't open scene file" << endl;
-        exit (-1);
+        error = string("can't open scene file ") + filnam;
+        return false;
     }
 
     int lastMaterialLoaded = 0;
-    std::vector< int > tris;
-    std::vector< double > verts;
-
-    while ( !inFile.eof() ) {
+    string group;
+    // OBJ files being read, at most one per core at a time
+    int threads = max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+    vector<objload*> loads;
+    deque<objload*> reading;
+    // Spheres of the current run of s lines, x y z r each, while clouds are made
+    vector<double> spheres;
+    // What is wrong with line number lineNumber, which ends the parse
+    string wrong;
+    int lineNumber = 0;
+
+    while ( wrong.empty() && !inFile.eof() ) {
         getline (inFile, line);
+        ++lineNumber;
+        if (countTokens(line) < tokensNeeded(line)) {
+            ostringstream needed;
+            needed << "needs " << tokensNeeded(line) - 1 << " values after " << line.substr(0, line[0] == 'l' ? 3 : 1);
+            wrong = needed.str();
+            break;
+        }
+        // Blank lines and comments don't end a run, anything else does
+        if (!line.empty() && line[0] != 's' && line[0] != '/')
+            finishSpheres(spheres, lastMaterialLoaded, group, sObjects);
 
         switch (line[0])  {
 
@@ -172,9 +576,14 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
                 y  = getTokenAsFloat (line, 2);
                 z  = getTokenAsFloat (line, 3);
                 r  = getTokenAsFloat (line, 4);
-				sphere *sp = new sphere(point(x, y, z), r);
+				if (sObjects.sphereClouds) {
+					double s[4] = {x, y, z, r};
+					spheres.insert(spheres.end(), s, s + 4);
+					break;
+				}
+				sphere *sp = new (sObjects.store) sphere(point(x, y, z), r);
 				sp->setMaterial(lastMaterialLoaded);
-				sObjects.surfaces.push_back(sp);
+				addSurface(sObjects, sp, group);
                 break;
 				}
             case 't': {
@@ -192,9 +601,9 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
                 point p1 = point (x1, y1, z1);
                 point p2 = point (x2, y2, z2);
                 point p3 = point (x3, y3, z3);
-                triangle *tr = new triangle (p1, p2, p3);
+                triangle *tr = new (sObjects.store) triangle(p1, p2, p3);
                 tr->setMaterial(lastMaterialLoaded);
-                sObjects.surfaces.push_back(tr);
+                addSurface(sObjects, tr, group);
                 break;
             	}
             case 'p': {
@@ -205,9 +614,13 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
             	nz = getTokenAsFloat (line, 3);
             	d = getTokenAsFloat (line, 4);
             	mvector norm = mvector (nx, ny, nz);
-            	plane *pl = new plane (norm, d);
+            	if (isZero(norm)) {
+            		wrong = "the plane's normal is zero";
+            		break;
+            	}
+            	plane *pl = new (sObjects.store) plane(norm, d);
             	pl->setMaterial(lastMaterialLoaded);
-            	sObjects.surfaces.push_back(pl);
+            	addSurface(sObjects, pl, group);
                 break;
             	}
             case 'c':   {
@@ -224,14 +637,30 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
                 ih = getTokenAsFloat (line, 9);
                 pw = (int) getTokenAsFloat (line, 10);
                 ph = (int) getTokenAsFloat (line, 11);
+				if (isZero(mvector(vx, vy, vz)) || pw < 1 || ph < 1) {
+					wrong = "the camera needs a direction and at least one pixel a side";
+					break;
+				}
+				// An optional name after the size, cameras without one are cam0, cam1...
+				string name = getTokenAsString (line, 12);
+				if (name.empty()) {
+					ostringstream generated;
+					generated << "cam" << sObjects.cameras.size();
+					name = generated.str();
+				}
+				if (sObjects.findCamera(name)) {
+					wrong = "there is already a camera called " + name;
+					break;
+				}
 				camera *cam  = new camera(xx, yy, zz, vx, vy, vz, dd, iw, ih, pw, ph);
-				sObjects.setCamera(cam);
+				cam->setName(name);
+				sObjects.addCamera(cam);
             	break;
 				}
             case 'l':
 				// light
                 // slightly different from the rest, we need to examine the second param,
-                switch (line[2]) {
+                switch (line.size() > 2 ? line[2] : 0) {
                     case 'p': {
 						// point light
 						double x, y, z, r, g, b;
@@ -241,7 +670,7 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
 						r = getTokenAsFloat (line, 5);
 						g = getTokenAsFloat (line, 6);
 						b = getTokenAsFloat (line, 7);
-						p_light *pl = new p_light(point(x, y, z), RGB(r, g, b));
+						p_light *pl = new (sObjects.store) p_light(point(x, y, z), RGB(r, g, b));
 						sObjects.lights.push_back(pl);
                     	break;
 						}
@@ -261,7 +690,11 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
 						r = getTokenAsFloat (line, 12);
 						g = getTokenAsFloat (line, 13);
 						b = getTokenAsFloat (line, 14);
-						s_light *sl = new s_light(point(x, y, z), mvector(dx, dy, dz),
+						if (isZero(mvector(ux, uy, uz).cross(mvector(dx, dy, dz)))) {
+							wrong = "the light's direction and u must be non-zero and not parallel";
+							break;
+						}
+						s_light *sl = new (sObjects.store) s_light(point(x, y, z), mvector(dx, dy, dz),
 													mvector(ux, uy, uz), len, RGB (r, g, b));
 						sObjects.lights.push_back(sl);
                         break;
@@ -291,26 +724,54 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
 				ig = getTokenAsFloat (line, 9);
 				ib = getTokenAsFloat (line, 10);
 
-				lastMaterialLoaded = getMaterialIndex(sObjects.materials, dr, dg, db, sr, sg, sb,
-														r, ir, ig, ib);
+				lastMaterialLoaded = sObjects.materials.intern(material(dr, dg, db, sr, sg, sb,
+																		r, ir, ig, ib));
                 break;
             }
             case 'w': {
-            	// WaveFront Obj file
-            	readWavefrontFile(getFileName(line), tris, verts);
-            	for (unsigned int i = 0; i < tris.size(); i+=3) {
-            		int p1_i = 3*tris[i];
-            		int p2_i = 3*tris[i+1];
-            		int p3_i = 3*tris[i+2];
-            		point p1 = point (verts[p1_i], verts[p1_i+1], verts[p1_i+2]);
-            		point p2 = point (verts[p2_i], verts[p2_i+1], verts[p2_i+2]);
-            		point p3 = point (verts[p3_i], verts[p3_i+1], verts[p3_i+2]);
-            		triangle *tr = new triangle (p1, p2, p3);
-    				tr->setMaterial(lastMaterialLoaded);
-            		sObjects.surfaces.push_back(tr);
+            	string file = getFileName(line);
+            	if (file.empty()) {
+            		wrong = "w needs a file name";
+            		break;
+            	}
+            	if (sObjects.proxies) {
+            		// Only the bounds for now, the triangles load when a ray gets there
+            		meshproxy *mp = new (sObjects.store) meshproxy(*sObjects.proxies, file, wrong);
+            		if (!wrong.empty())
+            			break;
+            		mp->setMaterial(lastMaterialLoaded);
+            		addSurface(sObjects, mp, group);
+            		break;
             	}
+            	// WaveFront Obj file, read in the background
+            	objload *job = new objload;
+            	job->file = file;
+            	job->line = lineNumber;
+            	job->counting = sObjects.perf != 0;
+            	job->material = lastMaterialLoaded;
+            	job->group = group;
+            	job->position = sObjects.surfaces.size();
+            	job->quantizeBits = sObjects.quantizeBits;
+            	job->lod = sObjects.lodPixels > 0.0;
+            	job->clean = sObjects.cleanMeshes;
+            	if ((int) reading.size() == threads) {
+            		pthread_join(reading.front()->reader, 0);
+            		reading.pop_front();
+            	}
+            	// Without a thread of its own, it is read now
+            	if (pthread_create(&job->reader, 0, readObjMain, job) == 0)
+            		reading.push_back(job);
+            	else {
+            		job->counting = false;
+            		readObjMain(job);
+            	}
+            	loads.push_back(job);
             	break;
             	}
+            case 'g':
+				// group: names the surfaces that follow, so sequences can move them
+				group = getTokenAsString (line, 1);
+				break;
             case '/':
                 // comment
                 break;
@@ -321,4 +782,17 @@ void parseSceneFile (const char *filnam, sceneobjects &sObjects) {
         }
 
     }
+    if (!wrong.empty()) {
+        abandonObjLoads(loads, reading);
+        ostringstream where;
+        where << filnam << ":" << lineNumber << ": " << wrong;
+        error = where.str();
+        return false;
+    }
+    finishSpheres(spheres, lastMaterialLoaded, group, sObjects);
+    if (!finishObjLoads(loads, reading, sObjects, threads, filnam, error))
+        return false;
+    if (sObjects.mortonOrder)
+        sortSurfaces(sObjects);
+    return true;
 }
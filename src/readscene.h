@@ -1,8 +1,25 @@
 #ifndef READSCENE_H
 #define READSCENE_H
 
+#include <string>
+#include <vector>
 #include "sceneobjects.h"
 
-void parseSceneFile (const char *filnam, sceneobjects &sObjects);
+/*
+ * Reads the scene file into sObjects. Returns false with the file, line
+ * and reason in error on the first line that can't be used, or the first
+ * OBJ file that can't be read; sObjects then holds the part of the scene
+ * read so far.
+ */
+bool parseSceneFile (const char *filnam, sceneobjects &sObjects, std::string &error);
+/*
+ * Vertex triples and zero based triangle indices of an OBJ file. False
+ * with the reason in error if it can't be opened or a face is out of range.
+ */
+bool readWavefrontFile (const char *file, std::vector<int> &tris, std::vector<double> &verts,
+						std::string &error);
+/* Token whichToken of a scene style line, counting the command letter as 0 */
+double getTokenAsFloat (string inString, int whichToken);
+string getTokenAsString (string inString, int whichToken);
 
 #endif
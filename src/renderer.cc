@@ -0,0 +1,128 @@
+#include "renderer.h"
+#include "readscene.h"
+#include "sphere.h"
+#include "plane.h"
+#include "triangle.h"
+#include "telemetry.h"
+
+renderer::renderer () {
+	objs = new sceneobjects();
+	cancelled = 0;
+	lastRays = 0;
+	lastSeconds = 0.0;
+}
+
+renderer::~renderer () {
+	delete objs;
+}
+
+int renderer::addMaterial (const RGB &d, const RGB &s, double r, const RGB &i) {
+	return objs->materials.intern(material(d.r, d.g, d.b, s.r, s.g, s.b, r, i.r, i.g, i.b));
+}
+
+void renderer::addSphere (const point &center, double radius, int material) {
+	sphere *sp = new (objs->store) sphere(center, radius);
+	sp->setMaterial(material);
+	objs->surfaces.push_back(sp);
+	objs->geometryChanged();
+}
+
+void renderer::addTriangle (const point &p1, const point &p2, const point &p3, int material) {
+	triangle *tr = new (objs->store) triangle(p1, p2, p3);
+	tr->setMaterial(material);
+	objs->surfaces.push_back(tr);
+	objs->geometryChanged();
+}
+
+void renderer::addPlane (const mvector &normal, double d, int material) {
+	mvector n = normal;
+	plane *pl = new (objs->store) plane(n, d);
+	pl->setMaterial(material);
+	objs->surfaces.push_back(pl);
+	objs->geometryChanged();
+}
+
+void renderer::addMesh (const double *verts, const int *tris, size_t triCount, int material) {
+	for (size_t t = 0; t < triCount; ++t) {
+		const double *a = verts + 3*tris[3*t];
+		const double *b = verts + 3*tris[3*t + 1];
+		const double *c = verts + 3*tris[3*t + 2];
+		addTriangle(point(a[0], a[1], a[2]), point(b[0], b[1], b[2]), point(c[0], c[1], c[2]), material);
+	}
+}
+
+void renderer::addPointLight (const point &position, const RGB &intensity) {
+	objs->lights.push_back(new (objs->store) p_light(position, intensity));
+}
+
+void renderer::addAreaLight (const point &center, const mvector &dir, const mvector &u, double len,
+							 const RGB &intensity) {
+	objs->lights.push_back(new (objs->store) s_light(center, dir, u, len, intensity));
+}
+
+void renderer::setAmbient (const RGB &intensity) {
+	objs->al.set(intensity.r, intensity.g, intensity.b);
+}
+
+void renderer::setCamera (const point &eye, const mvector &dir, double d, double iw, double ih, int pw, int ph) {
+	objs->setCamera(new camera(eye.x, eye.y, eye.z, dir.x, dir.y, dir.z, d, iw, ih, pw, ph));
+}
+
+bool renderer::loadSceneFile (const char *file, std::string &error) {
+	size_t surfaces = objs->surfaces.size(), lights = objs->lights.size(), cameras = objs->cameras.size();
+	map<string, vector<surface*> > groups = objs->groups;
+	a_light al = objs->al;
+	if (!parseSceneFile(file, *objs, error)) {
+		/* Forget what was read, its memory stays in the arena until the renderer goes */
+		objs->surfaces.resize(surfaces);
+		objs->lights.resize(lights);
+		for (size_t c = cameras; c < objs->cameras.size(); ++c)
+			delete objs->cameras[c];
+		objs->cameras.resize(cameras);
+		objs->groups.swap(groups);
+		objs->al = al;
+		return false;
+	}
+	objs->geometryChanged();
+	return true;
+}
+
+int renderer::width () const {
+	camera *cam = objs->getCamera();
+	return cam ? cam->width() : 0;
+}
+
+int renderer::height () const {
+	camera *cam = objs->getCamera();
+	return cam ? cam->height() : 0;
+}
+
+unsigned long renderer::rays () const {
+	return lastRays;
+}
+
+double renderer::seconds () const {
+	return lastSeconds;
+}
+
+void renderer::cancel () {
+	__sync_lock_test_and_set(&cancelled, 1);
+}
+
+bool renderer::render (float *rgba, const renderoptions &o) {
+	camera *cam = objs->getCamera();
+	if (!cam || !o.validRanges() || !o.regionInImage(cam->width(), cam->height()))
+		return false;
+	renderoptions opts = o;
+	opts.processes = 1;
+	cancelled = 0;
+	opts.cancel = &cancelled;
+
+	telemetry tel;
+	tel.setConsole(false);
+	/* fpixel is four floats, so the caller's buffer is used as is */
+	cam->renderScene(*objs, opts, tel, reinterpret_cast<fpixel*>(rgba));
+	lastRays = tel.totalRays();
+	lastSeconds = tel.elapsed();
+	return !cancelled;
+}
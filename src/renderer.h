@@ -0,0 +1,89 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <cstddef>
+#include <string>
+#include "basic_constructs.h"
+#include "renderoptions.h"
+
+class sceneobjects;
+
+/*
+ * Entry point for embedding raytra. Builds a scene in memory, the same
+ * primitives a scene file describes, and renders it into a float RGBA
+ * buffer owned by the caller, so no scene text or EXR has to round trip
+ * through disk.
+ *
+ * The library is arena.cc, basic_constructs.cc, camera.cc, exrfile.cc,
+ * gbuffer.cc, lodmesh.cc, material.cc, meshcleanup.cc, meshproxy.cc,
+ * plane.cc, quantizedmesh.cc, readscene.cc, renderer.cc, sphere.cc,
+ * spherecloud.cc, sphericalrect.cc, telemetry.cc, tilecache.cc,
+ * triangle.cc and workers.cc, linked with OpenEXR and pthreads. Hosts
+ * include only this header, which pulls in no OpenEXR headers and no
+ * using directives.
+ *
+ *   renderer r;
+ *   int m = r.addMaterial(RGB(.5, .5, .5), RGB(), 0, RGB());
+ *   r.addSphere(point(0, 0, -5), 1, m);
+ *   r.addPointLight(point(5, 5, 0), RGB(20, 20, 20));
+ *   r.setCamera(point(0, 0, 0), mvector(0, 0, -1), 1, 1, 1, 256, 256);
+ *   std::vector<float> rgba(256*256*4);
+ *   r.render(&rgba[0], renderoptions());
+ */
+class renderer {
+	public:
+		renderer ();
+		~renderer ();
+		/* Arguments as on the m line of a scene file, returns the material index */
+		int addMaterial (const RGB &diffuse, const RGB &specular, double phongExponent, const RGB &reflective);
+		void addSphere (const point &center, double radius, int material);
+		void addTriangle (const point &p1, const point &p2, const point &p3, int material);
+		void addPlane (const mvector &normal, double d, int material);
+		/* tris holds 3*triCount zero based indices into verts, which holds x y z triples */
+		void addMesh (const double *verts, const int *tris, size_t triCount, int material);
+		void addPointLight (const point &position, const RGB &intensity);
+		void addAreaLight (const point &center, const mvector &dir, const mvector &u, double len, const RGB &intensity);
+		void setAmbient (const RGB &intensity);
+		/* As on the c line: eye, view direction, focal length, image plane size, pixels */
+		void setCamera (const point &eye, const mvector &dir, double d, double iw, double ih, int pw, int ph);
+		/*
+		 * Reads a scene file into the scene built so far. If it does not
+		 * parse, returns false with the reason in error and leaves the
+		 * scene as it was; materials it added stay, unused.
+		 */
+		bool loadSceneFile (const char *file, std::string &error);
+
+		/*
+		 * Renders into rgba, width*height*4 floats for the whole image. Only
+		 * the region in opts is written. Renders in this process, whatever
+		 * opts.processes says, so opts.tileDone sees every tile and can read
+		 * it from rgba as soon as it is called. Returns false if there is
+		 * no camera, the region or sample range in opts is empty or off
+		 * the image, or the render was cancelled.
+		 */
+		bool render (float *rgba, const renderoptions &opts);
+		/* Safe to call from another thread, stops render after the current tile */
+		void cancel ();
+
+		int width () const;
+		int height () const;
+		/* Rays traced and seconds taken by the last render */
+		unsigned long rays () const;
+		double seconds () const;
+		/* Needs sceneobjects.h; call scene().geometryChanged() after moving surfaces directly */
+		sceneobjects& scene () {
+			return *objs;
+		}
+
+	private:
+		/* Owned; a pointer so this header stays free of the OpenEXR ones */
+		sceneobjects *objs;
+		volatile int cancelled;
+		unsigned long lastRays;
+		double lastSeconds;
+		/* Not copyable, it owns the scene */
+		renderer (const renderer &);
+		renderer& operator= (const renderer &);
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef RENDEROPTIONS_H
+#define RENDEROPTIONS_H
+
+class perfcounters;
+
+/* Everything main hands to the renderer besides the scene itself */
+class renderoptions {
+	public:
+		renderoptions () {
+			pixelSamples = shadowSamples = 1;
+			useBBox = false;
+			maxDepth = 5;
+			minThroughput = 1.0/1024;
+			russianRoulette = false;
+			rouletteDepth = 2;
+			seed = 0;
+			x0 = y0 = 0;
+			x1 = y1 = -1;
+			firstSample = 0;
+			sampleCount = -1;
+			processes = 1;
+			pinWorkers = false;
+			tileSize = 32;
+			relight = false;
+			adaptiveShadows = false;
+			solidAngleLights = false;
+			tileCache = 0;
+			cancel = 0;
+			tileDone = 0;
+			tileContext = 0;
+			perf = 0;
+		}
+		/* True if this renders only part of the image or of the samples */
+		bool isPartial (int nx, int ny) const {
+			return x0 > 0 || y0 > 0 || (x1 >= 0 && x1 < nx - 1) || (y1 >= 0 && y1 < ny - 1) ||
+					firstSample > 0 || (sampleCount >= 0 && sampleCount < pixelSamples*pixelSamples);
+		}
+		/* False if the region or the sample range is empty or inverted */
+		bool validRanges () const {
+			return firstSample >= 0 && firstSample < pixelSamples*pixelSamples &&
+					(sampleCount < 0 || sampleCount >= 1) && (x1 < 0 || x1 >= x0) && (y1 < 0 || y1 >= y0);
+		}
+		/* False if no pixel of the region is in an nx by ny image */
+		bool regionInImage (int nx, int ny) const {
+			int cx0 = x0 > 0 ? x0 : 0, cy0 = y0 > 0 ? y0 : 0;
+			int cx1 = x1 < 0 || x1 > nx - 1 ? nx - 1 : x1;
+			int cy1 = y1 < 0 || y1 > ny - 1 ? ny - 1 : y1;
+			return cx0 <= cx1 && cy0 <= cy1;
+		}
+		/* Samples per side, the pixel and each area light get n*n */
+		int pixelSamples, shadowSamples;
+		bool useBBox;
+		/* Longest path, counting the camera ray */
+		int maxDepth;
+		/*
+		 * A path stops once every channel of its throughput (the product of
+		 * reflectances so far) falls below this. The default is about the
+		 * precision of a half float, so the cut off light is not visible.
+		 */
+		double minThroughput;
+		/* Past rouletteDepth bounces, randomly end paths and reweight survivors */
+		bool russianRoulette;
+		int rouletteDepth;
+		/* Same seed, same image, however the frame is split up */
+		unsigned int seed;
+		/* Inclusive pixel region to render, x1/y1 of -1 mean to the edge */
+		int x0, y0, x1, y1;
+		/*
+		 * Range of pixel sample indices to take, out of pixelSamples^2
+		 * stratified samples. sampleCount of -1 means the rest.
+		 */
+		int firstSample, sampleCount;
+		/* Worker processes to fork, each renders tiles of tileSize pixels square */
+		int processes;
+		/* Bind worker k to NUMA node k % nodes */
+		bool pinWorkers;
+		int tileSize;
+		/*
+		 * Keep the camera rays' hits with the camera and, while the geometry
+		 * and camera samples stay the same, reuse them in the next render
+		 * (see gbuffer.h). For changing only lights and materials.
+		 */
+		bool relight;
+		/*
+		 * Trace a coarse grid of each area light's shadow rays first and the
+		 * rest only in penumbrae, see montecarlo::adaptiveAreaLight
+		 */
+		bool adaptiveShadows;
+		/* Sample square lights evenly over the directions to them instead of over their area */
+		bool solidAngleLights;
+		/* Directory of finished tiles to reuse and add to, see tilecache.h */
+		const char *tileCache;
+		/* If set, rendering stops after the current tile once *cancel is non zero */
+		volatile int *cancel;
+		/*
+		 * If set, called with tileContext and the inclusive pixel bounds of
+		 * every finished tile, in the process that rendered it.
+		 */
+		void (*tileDone)(void *ctx, int x0, int y0, int x1, int y1);
+		void *tileContext;
+		/*
+		 * If set, forked workers each count their own events and they are
+		 * added to its RENDER phase, a row per worker
+		 */
+		perfcounters *perf;
+};
+
+#endif
@@ -2,41 +2,110 @@
 #define SCENEOBJECTS_H
 
 #include <vector>
+#include <string>
+#include <map>
 #include "camera.h"
 #include "surface.h"
 #include "light.h"
 #include "material.h"
+#include "arena.h"
+#include "meshproxy.h"
+#include "meshcleanup.h"
+#include "lodmesh.h"
 
 using namespace std;
 
+class perfcounters;
+
 class sceneobjects {
-		camera *pov;
 	public:
-		sceneobjects () {
-			pov = 0;
+		/* hugePages backs the surfaces and lights with huge pages, see arena.h */
+		sceneobjects (bool hugePages = false) : store(hugePages) {
+			geometryVersion = 0;
+			proxies = 0;
+			quantizeBits = 0;
+			cleanMeshes = false;
+			lodPixels = 0.0;
+			sphereClouds = false;
+			mortonOrder = false;
+			perf = 0;
+			// Put a default material in
+			materials.intern(material());
 		}
+		/* Surfaces and lights go with the arena, only cameras own memory */
 		~sceneobjects () {
-			delete pov;
-			for (vector<surface*>::iterator iter = surfaces.begin(); iter != surfaces.end(); ++iter)
-				delete (*iter);
-			for (vector<light*>::iterator iter = lights.begin(); iter != lights.end(); ++iter)
-				delete (*iter);
-			for (vector<material*>::iterator iter = materials.begin(); iter != materials.end(); ++iter)
+			/* Before the arena goes, the cache reaches into the proxies */
+			delete proxies;
+			for (vector<camera*>::iterator iter = cameras.begin(); iter != cameras.end(); ++iter)
 				delete (*iter);
 		}
+		/* Replaces every view with c */
 		void setCamera (camera *c) {
 			if (!c)
 				return;
-			if (pov)
-				delete pov;
-			pov = c;
+			for (vector<camera*>::iterator iter = cameras.begin(); iter != cameras.end(); ++iter)
+				delete (*iter);
+			cameras.assign(1, c);
 		}
+		void addCamera (camera *c) {
+			cameras.push_back(c);
+		}
+		/* The first view, which single view renders use */
 		camera* getCamera() {
-			return pov;
+			return cameras.empty() ? 0 : cameras[0];
+		}
+		/* 0 if there is no view called name */
+		camera* findCamera (const string &name) {
+			for (size_t c = 0; c < cameras.size(); ++c)
+				if (cameras[c]->getName() == name)
+					return cameras[c];
+			return 0;
 		}
+		/* All views share the surfaces, lights and materials below */
+		vector<camera*> cameras;
+		/*
+		 * How w lines are stored. Set at most one of proxies, quantizeBits
+		 * and lodPixels; otherwise the first one set wins.
+		 */
+		/* If set, w lines become mesh proxies loaded under its budget. Owned */
+		proxycache *proxies;
+		/* If 16 or 21, w lines become quantized meshes with that many bits per axis */
+		int quantizeBits;
+		/* If set, OBJ meshes go through meshcleanup as they load; cleaned counts what it removed */
+		bool cleanMeshes;
+		meshcleanup cleaned;
+		/*
+		 * If above 0, large w meshes become lodmeshes, which each view
+		 * renders at the coarsest level in error by at most lodPixels pixels.
+		 * lods lists them, they live in the arena like other surfaces
+		 */
+		double lodPixels;
+		vector<lodmesh*> lods;
+		/* If set, runs of s lines with one material become spherecloud surfaces */
+		bool sphereClouds;
+		/*
+		 * If set, parsing ends by putting surfaces in Morton order of their
+		 * boxes. Ties between surfaces at the same distance then go by that
+		 * order instead of the file's
+		 */
+		bool mortonOrder;
+		/*
+		 * If set, the threads that read and build OBJ meshes count their own
+		 * events, which are added to its LOAD phase, a row per thread
+		 */
+		perfcounters *perf;
+		/* Surfaces and lights are allocated from store: new (objs.store) sphere(...) */
+		arena store;
 		vector<surface*> surfaces;
+		/* Call after moving, adding or removing surfaces, so relighting traces again */
+		void geometryChanged () {
+			++geometryVersion;
+		}
+		unsigned long geometryVersion;
+		/* Surfaces after a g line in the scene file, by group name */
+		map<string, vector<surface*> > groups;
 		vector<light*> lights;
-		vector<material*> materials;
+		materialtable materials;
 		a_light al;
 };
 
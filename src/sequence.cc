@@ -0,0 +1,99 @@
+#include "sequence.h"
+#include "readscene.h"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+using namespace std;
+
+sequence::sequence (const char *file) {
+	ifstream in(file);
+	if (!in.is_open()) {
+		cerr << "can't open sequence file " << file << endl;
+		exit(-1);
+	}
+	string line;
+	while (getline(in, line)) {
+		if (line.empty() || line[0] == '/')
+			continue;
+		if (line[0] == 'f')
+			frameStarts.push_back(lines.size());
+		else if (frameStarts.empty()) {
+			cerr << "error: sequence changes before the first f line" << endl;
+			exit(-1);
+		} else
+			lines.push_back(line);
+	}
+}
+
+/* The group's surfaces, exits if there is no such group */
+static vector<surface*>& findGroup (sceneobjects &objs, const string &name) {
+	map<string, vector<surface*> >::iterator found = objs.groups.find(name);
+	if (found == objs.groups.end()) {
+		cerr << "error: the scene has no group called " << name << endl;
+		exit(-1);
+	}
+	return found->second;
+}
+
+void sequence::apply (int frame, sceneobjects &objs) const {
+	size_t end = frame + 1 < frames() ? frameStarts[frame + 1] : lines.size();
+	for (size_t n = frameStarts[frame]; n < end; ++n) {
+		const string &line = lines[n];
+		switch (line[0]) {
+			case 't': {
+				vector<surface*> &group = findGroup(objs, getTokenAsString(line, 1));
+				mvector delta(getTokenAsFloat(line, 2), getTokenAsFloat(line, 3), getTokenAsFloat(line, 4));
+				for (size_t s = 0; s < group.size(); ++s)
+					group[s]->translate(delta);
+				objs.geometryChanged();
+				break;
+			}
+			case 'm': {
+				vector<surface*> &group = findGroup(objs, getTokenAsString(line, 1));
+				double v[10];
+				for (int t = 0; t < 10; ++t)
+					v[t] = getTokenAsFloat(line, t + 2);
+				int mat = objs.materials.intern(material(v[0], v[1], v[2], v[3], v[4], v[5],
+														v[6], v[7], v[8], v[9]));
+				for (size_t s = 0; s < group.size(); ++s)
+					group[s]->setMaterial(mat);
+				break;
+			}
+			case 'l': {
+				size_t index = (size_t) getTokenAsFloat(line, 1);
+				if (index >= objs.lights.size()) {
+					cerr << "error: the scene has no light " << index << endl;
+					exit(-1);
+				}
+				objs.lights[index]->moveTo(point(getTokenAsFloat(line, 2), getTokenAsFloat(line, 3),
+												  getTokenAsFloat(line, 4)));
+				objs.lights[index]->setIntensity(RGB(getTokenAsFloat(line, 5), getTokenAsFloat(line, 6),
+													  getTokenAsFloat(line, 7)));
+				break;
+			}
+			case 'c': {
+				double v[11];
+				for (int t = 0; t < 11; ++t)
+					v[t] = getTokenAsFloat(line, t + 1);
+				string name = getTokenAsString(line, 12);
+				size_t c = 0;
+				if (!name.empty())
+					while (c < objs.cameras.size() && objs.cameras[c]->getName() != name)
+						++c;
+				if (c >= objs.cameras.size()) {
+					cerr << "error: the scene has no camera called " << name << endl;
+					exit(-1);
+				}
+				camera *cam = new camera(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8],
+										 (int) v[9], (int) v[10]);
+				cam->setName(objs.cameras[c]->getName());
+				delete objs.cameras[c];
+				objs.cameras[c] = cam;
+				break;
+			}
+			default:
+				cerr << "error: unknown sequence change: " << line << endl;
+				exit(-1);
+		}
+	}
+}
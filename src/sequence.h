@@ -0,0 +1,41 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <string>
+#include <vector>
+#include "sceneobjects.h"
+
+/*
+ * An animation as changes to a scene that stays loaded. The sequence
+ * file uses scene file syntax; every f line starts a frame, and the
+ * lines after it change the scene left by the previous frame:
+ *
+ *   f                                 next frame
+ *   t GROUP dx dy dz                  move the surfaces of a g group
+ *   m GROUP dr dg db sr sg sb r ir ig ib
+ *                                     give a group a new material
+ *   l INDEX x y z r g b               move and recolor the INDEXth light
+ *   c x y z vx vy vz d iw ih pw ph [name]
+ *                                     replace the named (or first) camera
+ *
+ * Moved surfaces only refit their own boxes, nothing is reparsed. With
+ * renderoptions::relight, frames that change only lights, materials or
+ * cameras other than the one rendered reuse their camera ray hits.
+ */
+class sequence {
+	public:
+		/* Exits with a message on cerr if the file can't be read */
+		sequence (const char *file);
+		int frames () const {
+			return (int) frameStarts.size();
+		}
+		/* Applies frame's changes; frames must be applied in order */
+		void apply (int frame, sceneobjects &objs) const;
+
+	private:
+		std::vector<std::string> lines;
+		/* Index in lines of each frame's first change */
+		std::vector<size_t> frameStarts;
+};
+
+#endif
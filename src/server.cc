@@ -0,0 +1,443 @@
+#include "server.h"
+#include "readscene.h"
+#include "workers.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <exception>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+using namespace std;
+
+/* Seconds a client has to send its command line */
+static const int clientTimeout = 10;
+/* Most pixels a side of a camera= override */
+static const double maxPixels = 65536;
+
+/* Hands a connection to its thread */
+class clientarg {
+	public:
+		renderserver *server;
+		int fd;
+};
+
+renderserver::renderserver (const string &path, const renderoptions &opts, telemetry &t)
+: socketPath(path), defaults(opts), tel(t) {
+	listenFd = -1;
+	stopping = false;
+	nextId = 1;
+	clients = 0;
+	current = 0;
+	cancelFlag = static_cast<volatile int*>(sharedAlloc(sizeof(int)));
+	*cancelFlag = 0;
+	pthread_mutex_init(&lock, 0);
+	pthread_cond_init(&queueChanged, 0);
+	pthread_cond_init(&jobChanged, 0);
+}
+
+renderserver::~renderserver () {
+	/* Client threads may still be replying */
+	pthread_mutex_lock(&lock);
+	while (clients > 0)
+		pthread_cond_wait(&jobChanged, &lock);
+	pthread_mutex_unlock(&lock);
+
+	for (map<int, job*>::iterator iter = jobs.begin(); iter != jobs.end(); ++iter)
+		delete iter->second;
+	for (map<string, cachedscene>::iterator iter = scenes.begin(); iter != scenes.end(); ++iter)
+		delete iter->second.objs;
+	sharedFree((void *) cancelFlag, sizeof(int));
+	pthread_cond_destroy(&jobChanged);
+	pthread_cond_destroy(&queueChanged);
+	pthread_mutex_destroy(&lock);
+}
+
+int renderserver::run () {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(addr.sun_path)) {
+		cerr << "socket path too long: " << socketPath << endl;
+		return 1;
+	}
+	strcpy(addr.sun_path, socketPath.c_str());
+	listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socketPath.c_str());
+	if (listenFd < 0 || bind(listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+			listen(listenFd, 16) != 0) {
+		cerr << "can't listen on " << socketPath << ": " << strerror(errno) << endl;
+		return 1;
+	}
+	pthread_t acceptor;
+	if (pthread_create(&acceptor, 0, acceptMain, this) != 0) {
+		cerr << "can't start accept thread" << endl;
+		return 1;
+	}
+	cout << "Serving on " << socketPath << endl;
+
+	/* Jobs run here, one at a time */
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (queue.empty() && !stopping)
+			pthread_cond_wait(&queueChanged, &lock);
+		if (stopping)
+			break;
+		job *j = queue.front();
+		queue.pop_front();
+		j->state = RUNNING;
+		current = j;
+		*cancelFlag = 0;
+		pthread_mutex_unlock(&lock);
+		render(j);
+		pthread_mutex_lock(&lock);
+		current = 0;
+	}
+	while (!queue.empty()) {
+		queue.front()->state = CANCELLED;
+		queue.pop_front();
+	}
+	pthread_cond_broadcast(&jobChanged);
+	pthread_mutex_unlock(&lock);
+
+	shutdown(listenFd, SHUT_RDWR);
+	close(listenFd);
+	pthread_join(acceptor, 0);
+	unlink(socketPath.c_str());
+	cout << "Server stopped" << endl;
+	return 0;
+}
+
+void* renderserver::acceptMain (void *self) {
+	renderserver *s = static_cast<renderserver*>(self);
+	for (;;) {
+		int fd = accept(s->listenFd, 0, 0);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Listening socket was shut down */
+			break;
+		}
+		/* A client that never finishes its line would otherwise hold up shutdown */
+		struct timeval timeout;
+		timeout.tv_sec = clientTimeout;
+		timeout.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		clientarg *arg = new clientarg;
+		arg->server = s;
+		arg->fd = fd;
+		pthread_mutex_lock(&s->lock);
+		s->clients++;
+		pthread_mutex_unlock(&s->lock);
+		pthread_t client;
+		if (pthread_create(&client, 0, clientMain, arg) != 0) {
+			close(fd);
+			delete arg;
+			pthread_mutex_lock(&s->lock);
+			s->clients--;
+			pthread_mutex_unlock(&s->lock);
+			continue;
+		}
+		pthread_detach(client);
+	}
+	return 0;
+}
+
+void* renderserver::clientMain (void *a) {
+	clientarg *arg = static_cast<clientarg*>(a);
+	renderserver *s = arg->server;
+	s->serveClient(arg->fd);
+	close(arg->fd);
+	delete arg;
+	pthread_mutex_lock(&s->lock);
+	s->clients--;
+	pthread_cond_broadcast(&s->jobChanged);
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+/* The client may have hung up, which is fine */
+static void reply (int fd, const string &line) {
+	string out = line + "\n";
+	send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+}
+
+void renderserver::serveClient (int fd) {
+	string line;
+	char c;
+	while (line.size() < 4096 && recv(fd, &c, 1, 0) == 1 && c != '\n')
+		line += c;
+	istringstream in(line);
+	string cmd;
+	in >> cmd;
+
+	if (cmd == "render") {
+		string rest;
+		getline(in, rest);
+		int id = submit(rest, fd);
+		if (id < 0)
+			return;
+		pthread_mutex_lock(&lock);
+		job *j = jobs[id];
+		while (j->state == QUEUED || j->state == RUNNING)
+			pthread_cond_wait(&jobChanged, &lock);
+		ostringstream result;
+		if (j->state == DONE)
+			result << "done " << id << " " << j->seconds;
+		else if (j->state == CANCELLED)
+			result << "cancelled " << id;
+		else
+			result << "failed " << id << " " << j->message;
+		jobs.erase(id);
+		delete j;
+		pthread_mutex_unlock(&lock);
+		reply(fd, result.str());
+	} else if (cmd == "cancel") {
+		int id = -1;
+		in >> id;
+		reply(fd, cancel(id));
+	} else if (cmd == "status") {
+		reply(fd, status());
+	} else if (cmd == "shutdown") {
+		pthread_mutex_lock(&lock);
+		stopping = true;
+		pthread_cond_signal(&queueChanged);
+		pthread_mutex_unlock(&lock);
+		reply(fd, "ok");
+	} else {
+		reply(fd, "error unknown command '" + cmd + "'");
+	}
+}
+
+/* Comma separated numbers into vals, true if there were exactly n */
+static bool parseList (const string &list, double *vals, int n) {
+	istringstream in(list);
+	string item;
+	int i = 0;
+	while (getline(in, item, ',')) {
+		if (i == n)
+			return false;
+		vals[i++] = atof(item.c_str());
+	}
+	return i == n;
+}
+
+/* Queues a render job and replies with its id, or replies with an error and returns -1 */
+int renderserver::submit (const string &args, int fd) {
+	job *j = new job;
+	j->opts = defaults;
+	j->overrideCamera = false;
+	j->state = QUEUED;
+	j->seconds = 0.0;
+
+	istringstream in(args);
+	string token;
+	string error;
+	while (in >> token) {
+		size_t eq = token.find('=');
+		string key = token.substr(0, eq);
+		string value = eq == string::npos ? "" : token.substr(eq + 1);
+		double region[4];
+		if (key == "scene")
+			j->scene = value;
+		else if (key == "out")
+			j->out = value;
+		else if (key == "view")
+			j->view = value;
+		else if (key == "samples")
+			j->opts.pixelSamples = atoi(value.c_str());
+		else if (key == "shadow")
+			j->opts.shadowSamples = atoi(value.c_str());
+		else if (key == "seed")
+			j->opts.seed = strtoul(value.c_str(), 0, 10);
+		else if (key == "depth")
+			j->opts.maxDepth = atoi(value.c_str());
+		else if (key == "processes")
+			j->opts.processes = atoi(value.c_str());
+		else if (key == "region" && parseList(value, region, 4)) {
+			j->opts.x0 = (int) region[0];
+			j->opts.y0 = (int) region[1];
+			j->opts.x1 = (int) region[2];
+			j->opts.y1 = (int) region[3];
+		} else if (key == "camera" && parseList(value, j->cam, 11))
+			j->overrideCamera = true;
+		else
+			error = "bad argument " + token;
+	}
+	if (error.empty() && (j->scene.empty() || j->out.empty()))
+		error = "scene= and out= are required";
+	if (error.empty() && (j->opts.pixelSamples < 1 || j->opts.shadowSamples < 1 || j->opts.maxDepth < 1 ||
+			j->opts.processes < 1 || j->opts.processes >= telemetry::maxThreads))
+		error = "bad sample, depth or process count";
+	if (error.empty() && !j->opts.validRanges())
+		error = "bad region or sample range";
+	/* Eye, direction, focal length, image plane size, pixels; a bad size would fail the allocation */
+	const double *c = j->cam;
+	if (error.empty() && j->overrideCamera && (c[6] <= 0 || c[7] <= 0 || c[8] <= 0 ||
+			!(c[9] >= 1 && c[9] <= maxPixels) || !(c[10] >= 1 && c[10] <= maxPixels) ||
+			(c[3] == 0 && c[4] == 0 && c[5] == 0)))
+		error = "bad camera, it needs a direction, positive sizes and 1 to 65536 pixels a side";
+	if (!error.empty()) {
+		delete j;
+		reply(fd, "error " + error);
+		return -1;
+	}
+
+	pthread_mutex_lock(&lock);
+	if (stopping) {
+		pthread_mutex_unlock(&lock);
+		delete j;
+		reply(fd, "error shutting down");
+		return -1;
+	}
+	j->id = nextId++;
+	jobs[j->id] = j;
+	queue.push_back(j);
+	pthread_cond_signal(&queueChanged);
+	pthread_mutex_unlock(&lock);
+
+	ostringstream queued;
+	queued << "queued " << j->id;
+	reply(fd, queued.str());
+	return j->id;
+}
+
+string renderserver::cancel (int id) {
+	pthread_mutex_lock(&lock);
+	map<int, job*>::iterator found = jobs.find(id);
+	string ret = "ok";
+	if (found == jobs.end() || (found->second->state != QUEUED && found->second->state != RUNNING)) {
+		ret = "error no such job";
+	} else if (found->second->state == QUEUED) {
+		for (deque<job*>::iterator iter = queue.begin(); iter != queue.end(); ++iter)
+			if (*iter == found->second) {
+				queue.erase(iter);
+				break;
+			}
+		found->second->state = CANCELLED;
+		pthread_cond_broadcast(&jobChanged);
+	} else {
+		/* The render loop checks this between tiles */
+		*cancelFlag = 1;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+string renderserver::status () {
+	ostringstream out;
+	pthread_mutex_lock(&lock);
+	if (current)
+		out << current->id << " running " << current->scene << " " << current->out << "\n";
+	for (deque<job*>::iterator iter = queue.begin(); iter != queue.end(); ++iter)
+		out << (*iter)->id << " queued " << (*iter)->scene << " " << (*iter)->out << "\n";
+	out << scenes.size() << " scenes loaded\nend";
+	pthread_mutex_unlock(&lock);
+	return out.str();
+}
+
+/*
+ * Loaded scene for path, reloaded if the file changed since. Only the
+ * render thread loads, but status reads the map too, so it is locked
+ * except while parsing.
+ */
+sceneobjects* renderserver::getScene (const string &path, string &error) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		error = "can't open scene " + path;
+		return 0;
+	}
+	sceneobjects *stale = 0;
+	pthread_mutex_lock(&lock);
+	map<string, cachedscene>::iterator found = scenes.find(path);
+	if (found != scenes.end()) {
+		if (found->second.mtime == (long) st.st_mtime) {
+			sceneobjects *objs = found->second.objs;
+			pthread_mutex_unlock(&lock);
+			return objs;
+		}
+		stale = found->second.objs;
+		scenes.erase(found);
+	}
+	pthread_mutex_unlock(&lock);
+	delete stale;
+
+	cachedscene loaded;
+	loaded.objs = new sceneobjects();
+	loaded.mtime = st.st_mtime;
+	/* A bad scene fails its job, and what was read of it goes */
+	if (!parseSceneFile(path.c_str(), *loaded.objs, error)) {
+		delete loaded.objs;
+		return 0;
+	}
+	cout << "Loaded scene " << path << endl;
+	pthread_mutex_lock(&lock);
+	scenes[path] = loaded;
+	pthread_mutex_unlock(&lock);
+	return loaded.objs;
+}
+
+void renderserver::finish (job *j, jobState state, const string &message) {
+	pthread_mutex_lock(&lock);
+	j->state = state;
+	j->message = message;
+	/* Its client deletes j once woken, so status must not see it as running */
+	if (current == j)
+		current = 0;
+	pthread_cond_broadcast(&jobChanged);
+	pthread_mutex_unlock(&lock);
+}
+
+void renderserver::render (job *j) {
+	string error;
+	sceneobjects *objs = getScene(j->scene, error);
+	if (!objs) {
+		finish(j, FAILED, error);
+		return;
+	}
+	camera *cam = j->view.empty() ? objs->getCamera() : objs->findCamera(j->view);
+	if (!cam && !j->view.empty() && !j->overrideCamera) {
+		finish(j, FAILED, "scene has no camera called " + j->view);
+		return;
+	}
+	/* Shared memory for the image and tiles can run out, which fails just this job */
+	camera *own = 0;
+	try {
+		if (j->overrideCamera) {
+			const double *c = j->cam;
+			own = new camera(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8], (int) c[9], (int) c[10]);
+			cam = own;
+		}
+		if (!cam) {
+			finish(j, FAILED, "scene has no camera");
+			return;
+		}
+		if (!j->opts.regionInImage(cam->width(), cam->height())) {
+			ostringstream region;
+			region << "region lies outside the " << cam->width() << "x" << cam->height() << " image";
+			delete own;
+			finish(j, FAILED, region.str());
+			return;
+		}
+
+		renderoptions opts = j->opts;
+		opts.cancel = cancelFlag;
+		cam->renderScene(*objs, opts, tel);
+		j->seconds = tel.elapsed();
+		if (*cancelFlag) {
+			delete own;
+			finish(j, CANCELLED, "");
+			return;
+		}
+		cam->writeEXR(j->out.c_str(), opts);
+		finish(j, DONE, "");
+	} catch (const exception &e) {
+		finish(j, FAILED, e.what());
+	}
+	delete own;
+}
@@ -0,0 +1,86 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <map>
+#include <deque>
+#include <pthread.h>
+#include "renderoptions.h"
+#include "telemetry.h"
+
+class sceneobjects;
+
+/*
+ * Long running render server. Scenes stay loaded between jobs, keyed by
+ * path and reloaded only when the file's mtime changes, so a job costs
+ * just its render time. Clients connect to a Unix stream socket and send
+ * one command line per connection, within ten seconds of connecting:
+ *
+ *   render scene=PATH out=PATH [samples=N] [shadow=N] [seed=N] [depth=N]
+ *          [processes=N] [region=X0,Y0,X1,Y1] [view=NAME]
+ *          [camera=X,Y,Z,VX,VY,VZ,D,IW,IH,PW,PH]
+ *       replies "queued ID", then "done ID SECONDS", "cancelled ID" or
+ *       "failed ID REASON" once the job leaves the queue
+ *   cancel ID     drops a queued job or stops a running one after its current tile
+ *   status        one line per queued or running job, then "end"
+ *   shutdown      finishes the running job, cancels the queued ones and exits
+ *
+ * Jobs run one at a time in submission order; unset render options fall
+ * back to the ones the server was started with. A scene that does not
+ * parse fails its job with the parser's complaint as the reason.
+ */
+class renderserver {
+	public:
+		renderserver (const std::string &socketPath, const renderoptions &defaults, telemetry &tel);
+		~renderserver ();
+		/* Serves until shutdown, returns the process exit status */
+		int run ();
+
+	private:
+		enum jobState {QUEUED, RUNNING, DONE, CANCELLED, FAILED};
+		class job {
+			public:
+				int id;
+				std::string scene, out, view;
+				renderoptions opts;
+				bool overrideCamera;
+				double cam[11];
+				jobState state;
+				std::string message;
+				double seconds;
+		};
+		class cachedscene {
+			public:
+				sceneobjects *objs;
+				long mtime;
+		};
+
+		std::string socketPath;
+		renderoptions defaults;
+		telemetry &tel;
+		int listenFd;
+		bool stopping;
+		int nextId;
+		/* Connection threads still running */
+		int clients;
+		/* Shared, so forked workers see a cancel too */
+		volatile int *cancelFlag;
+		job *current;
+		std::deque<job*> queue;
+		std::map<int, job*> jobs;
+		std::map<std::string, cachedscene> scenes;
+		pthread_mutex_t lock;
+		pthread_cond_t queueChanged, jobChanged;
+
+		static void* acceptMain (void *self);
+		static void* clientMain (void *arg);
+		void serveClient (int fd);
+		int submit (const std::string &args, int fd);
+		std::string cancel (int id);
+		std::string status ();
+		void render (job *j);
+		sceneobjects* getScene (const std::string &path, std::string &error);
+		void finish (job *j, jobState state, const std::string &message);
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "sphere.h"
+#include "arena.h"
+#include <new>
 #include <cmath>
 #include <iostream>
 using namespace std;
@@ -12,20 +14,23 @@ sphere::sphere (const point &o, double r) {
 	box = bbox(min, max);
 }
 
+surface* sphere::relocate (void *slot) const {
+	return new (slot) sphere(*this);
+}
+
+void sphere::translate (const mvector &delta) {
+	o += delta;
+	box.translate(delta);
+}
+
 sphere::~sphere() {
 
 }
 
-bool sphere::intersect (const ray &r, double start, double end, intersection &info, bool useBBox) {
+bool sphere::intersect (const ray &r, double start, double end, intersection &info) {
 	double intersectionT;
 	if (!box.intersect(r, start, end, intersectionT))
 		return false;
-	if (useBBox) {
-		info.n = box.getNormal(r.evaluate(intersectionT));
-		info.t = intersectionT;
-		info.mat = mat;
-		return true;
-	}
 	/* discriminant formula
 	 * (d.(e-c))^2 - (d.d) ((e-c).(e-c) - R^2)
 	 */
@@ -9,7 +9,14 @@ class sphere : public surface {
 		point o;
 		double r;
 		sphere (const point &origin, double radius);
-		bool intersect (const ray &r, double start, double end, intersection &info, bool useBBox);
+		bool intersect (const ray &r, double start, double end, intersection &info);
+		void translate (const mvector &delta);
+		void hash (contenthash &h) const {
+			h.add('s');
+			h.add(o);
+			h.add(r);
+		}
+		surface* relocate (void *slot) const;
 		virtual ~sphere();
 };
 
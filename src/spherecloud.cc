@@ -0,0 +1,197 @@
+#include "spherecloud.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+using namespace std;
+
+/* Sphere ids by center along one axis */
+class centerorder {
+	public:
+		centerorder (const vector<double> &s, int a) : spheres(s), axis(a) {}
+		bool operator() (int a, int b) const {
+			return spheres[4*a + axis] < spheres[4*b + axis];
+		}
+	private:
+		const vector<double> &spheres;
+		int axis;
+};
+
+spherecloud::spherecloud (const vector<double> &spheres, arena &store) {
+	count = spheres.size() / 4;
+	leafCount = (int) ((count + width - 1) / width);
+	/* Lanes want their own alignment, more than the arena gives */
+	char *raw = static_cast<char*>(store.allocate(sizeof(sphereleaf) * leafCount + sizeof(lanes), leafCount));
+	leaves = reinterpret_cast<sphereleaf*>((reinterpret_cast<size_t>(raw) + sizeof(lanes) - 1) & ~(sizeof(lanes) - 1));
+
+	vector<int> ids(count);
+	for (size_t s = 0; s < count; ++s)
+		ids[s] = (int) s;
+	vector<cloudnode> tree;
+	leafCount = 0;
+	build(spheres, ids, 0, count, tree);
+	nodeCount = (int) tree.size();
+	nodes = static_cast<cloudnode*>(store.allocate(sizeof(cloudnode) * nodeCount));
+	copy(tree.begin(), tree.end(), nodes);
+	box = nodes[0].box;
+}
+
+/* Splits [first, last) of ids at a multiple of width, so only the last leaf is short */
+int spherecloud::build (const vector<double> &spheres, vector<int> &ids, size_t first, size_t last,
+						vector<cloudnode> &tree) {
+	double inf = numeric_limits<double>::infinity();
+	point lo(inf, inf, inf), hi(-inf, -inf, -inf), clo(inf, inf, inf), chi(-inf, -inf, -inf);
+	for (size_t i = first; i < last; ++i) {
+		const double *s = &spheres[4*ids[i]];
+		lo = point(min(lo.x, s[0] - s[3]), min(lo.y, s[1] - s[3]), min(lo.z, s[2] - s[3]));
+		hi = point(max(hi.x, s[0] + s[3]), max(hi.y, s[1] + s[3]), max(hi.z, s[2] + s[3]));
+		clo = point(min(clo.x, s[0]), min(clo.y, s[1]), min(clo.z, s[2]));
+		chi = point(max(chi.x, s[0]), max(chi.y, s[1]), max(chi.z, s[2]));
+	}
+	int node = (int) tree.size();
+	tree.push_back(cloudnode());
+	tree[node].box = bbox(lo, hi);
+
+	if (last - first <= (size_t) width) {
+		sphereleaf &leaf = leaves[leafCount];
+		tree[node].leaf = leafCount++;
+		tree[node].right = -1;
+		for (int k = 0; k < width; ++k) {
+			int id = ids[first + k < last ? first + k : first];
+			const double *s = &spheres[4*id];
+			leaf.cx[k] = s[0];
+			leaf.cy[k] = s[1];
+			leaf.cz[k] = s[2];
+			leaf.r2[k] = s[3] * s[3];
+			leaf.radius[k] = s[3];
+			leaf.index[k] = id;
+		}
+		return node;
+	}
+
+	mvector extent = chi - clo;
+	int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+	size_t mid = first + ((last - first) / 2 + width - 1) / width * width;
+	nth_element(ids.begin() + first, ids.begin() + mid, ids.begin() + last, centerorder(spheres, axis));
+	tree[node].leaf = -1;
+	build(spheres, ids, first, mid, tree);
+	int right = build(spheres, ids, mid, last, tree);
+	tree[node].right = right;
+	return node;
+}
+
+/*
+ * Closest hit over the leaves the ray reaches. The discriminants come
+ * out of the same operations sphere::intersect does, lane by lane, and
+ * lanes that pass also take sphere's box test, so they give the same hits.
+ */
+bool spherecloud::intersect (const ray &r, double start, double end, intersection &info) {
+	if (!box.overlaps(r, start, end))
+		return false;
+	lanes px, py, pz, dx, dy, dz;
+	for (int k = 0; k < width; ++k) {
+		px[k] = r.p.x;
+		py[k] = r.p.y;
+		pz[k] = r.p.z;
+		dx[k] = r.d.x;
+		dy[k] = r.d.y;
+		dz[k] = r.d.z;
+	}
+	double dd = r.d * r.d;
+	double closest = end;
+	int best = -1, bestLeaf = 0, bestLane = 0;
+
+	int stack[64], top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const cloudnode &node = nodes[stack[--top]];
+		/* Inclusive, a sphere at exactly closest can still win on order */
+		if (!node.box.overlaps(r, start, closest))
+			continue;
+		if (node.leaf < 0) {
+			stack[top++] = node.right;
+			stack[top++] = (int) (&node - nodes) + 1;
+			continue;
+		}
+		const sphereleaf &leaf = leaves[node.leaf];
+		lanes ecx = px - leaf.cx, ecy = py - leaf.cy, ecz = pz - leaf.cz;
+		lanes dec = dx * ecx + dy * ecy + dz * ecz;
+		lanes ecec = ecx * ecx + ecy * ecy + ecz * ecz;
+		lanes disc = dec * dec - (ecec - leaf.r2) * dd;
+		for (int k = 0; k < width; ++k) {
+			if (!(disc[k] >= 0))
+				continue;
+			double s_disc = sqrt(disc[k]);
+			double t1 = (-dec[k] + s_disc) / dd;
+			double t2 = (-dec[k] - s_disc) / dd;
+			if (t1 <= start || t2 <= start || (t1 >= end && t2 >= end))
+				continue;
+			/* sphere turns away rays that don't enter its box, so this does too */
+			double rad = leaf.radius[k], boxT;
+			bbox sb(point(leaf.cx[k] - rad, leaf.cy[k] - rad, leaf.cz[k] - rad),
+					point(leaf.cx[k] + rad, leaf.cy[k] + rad, leaf.cz[k] + rad));
+			if (!sb.intersect(r, start, end, boxT))
+				continue;
+			double t = t2 >= t1 ? t1 : t2;
+			if (t < closest || (t == closest && (best < 0 || leaf.index[k] < best))) {
+				closest = t;
+				best = leaf.index[k];
+				bestLeaf = node.leaf;
+				bestLane = k;
+			}
+		}
+	}
+	if (best < 0)
+		return false;
+	const sphereleaf &leaf = leaves[bestLeaf];
+	point o(leaf.cx[bestLane], leaf.cy[bestLane], leaf.cz[bestLane]);
+	info.mat = mat;
+	info.t = closest;
+	info.n = (r.evaluate(closest) - o) * (1.0/leaf.radius[bestLane]);
+	return true;
+}
+
+bool spherecloud::intersectBBox (const ray &r, double start, double end, intersection &info) {
+	double closest = numeric_limits<double>::infinity(), t;
+	int best = -1;
+	bbox hit;
+	for (int l = 0; l < leafCount; ++l)
+		for (int k = 0; k < width; ++k) {
+			const sphereleaf &leaf = leaves[l];
+			double rad = leaf.radius[k];
+			bbox b(point(leaf.cx[k] - rad, leaf.cy[k] - rad, leaf.cz[k] - rad),
+				   point(leaf.cx[k] + rad, leaf.cy[k] + rad, leaf.cz[k] + rad));
+			if (b.intersect(r, start, end, t) && (t < closest || (t == closest && leaf.index[k] < best))) {
+				closest = t;
+				best = leaf.index[k];
+				hit = b;
+			}
+		}
+	if (best < 0)
+		return false;
+	info.n = hit.getNormal(r.evaluate(closest));
+	info.t = closest;
+	info.mat = mat;
+	return true;
+}
+
+void spherecloud::translate (const mvector &delta) {
+	for (int l = 0; l < leafCount; ++l)
+		for (int k = 0; k < width; ++k) {
+			leaves[l].cx[k] += delta.x;
+			leaves[l].cy[k] += delta.y;
+			leaves[l].cz[k] += delta.z;
+		}
+	for (int n = 0; n < nodeCount; ++n)
+		nodes[n].box.translate(delta);
+	box.translate(delta);
+}
+
+void spherecloud::hash (contenthash &h) const {
+	h.add('c');
+	for (int l = 0; l < leafCount; ++l)
+		for (int k = 0; k < width; ++k) {
+			h.add(leaves[l].index[k]);
+			h.add(point(leaves[l].cx[k], leaves[l].cy[k], leaves[l].cz[k]));
+			h.add(leaves[l].radius[k]);
+		}
+}
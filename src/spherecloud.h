@@ -0,0 +1,56 @@
+#ifndef SPHERECLOUD_H
+#define SPHERECLOUD_H
+
+#include <vector>
+#include <cstddef>
+#include "surface.h"
+#include "arena.h"
+
+/*
+ * A run of spheres with one material, packed for particle sized scenes
+ * (consecutive s lines with sceneobjects::sphereClouds set). Spheres are
+ * kept eight to a leaf, centers and squared radii in lanes, so one pass
+ * over a leaf finds the discriminant for all eight with vector
+ * arithmetic and only the lanes the ray's line meets go on to the exact
+ * sphere test. Leaves sit under a tree of boxes, split at the median
+ * along the longest axis.
+ *
+ * Hits are those sphere::intersect gives for each sphere, box test
+ * included, closest first, ties to the sphere parsed first.
+ */
+class spherecloud : public surface {
+	public:
+		static const int width = 8;
+		/* spheres holds x y z radius for each sphere, in scene order */
+		spherecloud (const std::vector<double> &spheres, arena &store);
+		bool intersect (const ray &r, double start, double end, intersection &info);
+		/* Each sphere's box, as the bounding box preview draws spheres */
+		bool intersectBBox (const ray &r, double start, double end, intersection &info);
+		void translate (const mvector &delta);
+		void hash (contenthash &h) const;
+		size_t size () const {
+			return count;
+		}
+
+	private:
+		typedef double lanes __attribute__ ((vector_size (width * sizeof(double))));
+		/* Short leaves repeat their first sphere, which never wins a tie against itself */
+		struct sphereleaf {
+			lanes cx, cy, cz, r2;
+			double radius[width];
+			int index[width];
+		};
+		/* A leaf if leaf >= 0, else its children are the next node and right */
+		struct cloudnode {
+			bbox box;
+			int leaf, right;
+		};
+		size_t count;
+		int leafCount, nodeCount;
+		sphereleaf *leaves;
+		cloudnode *nodes;
+		int build (const std::vector<double> &spheres, std::vector<int> &ids, size_t first, size_t last,
+				   std::vector<cloudnode> &tree);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "sphericalrect.h"
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+static inline mvector unitCross (const mvector &a, const mvector &b) {
+	mvector n = a.cross(b);
+	n.normalize();
+	return n;
+}
+
+sphericalrect::sphericalrect (const point &c, const mvector &ex, const mvector &ey, const point &from) : o(from) {
+	double exl = sqrt(ex * ex), eyl = sqrt(ey * ey);
+	x = ex * (1.0 / exl);
+	y = ey * (1.0 / eyl);
+	z = x.cross(y);
+	mvector d = c - o;
+	z0 = d * z;
+	/* z points away from the rectangle */
+	if (z0 > 0.0) {
+		z = -z;
+		z0 = -z0;
+	}
+	x0 = d * x;
+	y0 = d * y;
+	x1 = x0 + exl;
+	y1 = y0 + eyl;
+	solidAngle = 0.0;
+	b0 = b1 = k = 0.0;
+	if (z0 == 0.0)
+		return;
+
+	/* Normals of the planes through o and each edge, and the angles between them */
+	mvector v00(x0, y0, z0), v01(x0, y1, z0), v10(x1, y0, z0), v11(x1, y1, z0);
+	mvector n0 = unitCross(v00, v10), n1 = unitCross(v10, v11);
+	mvector n2 = unitCross(v11, v01), n3 = unitCross(v01, v00);
+	double g0 = acos(max(-1.0, min(1.0, -(n0 * n1))));
+	double g1 = acos(max(-1.0, min(1.0, -(n1 * n2))));
+	double g2 = acos(max(-1.0, min(1.0, -(n2 * n3))));
+	double g3 = acos(max(-1.0, min(1.0, -(n3 * n0))));
+	b0 = n0.z;
+	b1 = n2.z;
+	k = 2.0 * M_PI - g2 - g3;
+	solidAngle = max(0.0, g0 + g1 - k);
+}
+
+point sphericalrect::sample (double u, double v) const {
+	/* u picks the x of the point by its share of the solid angle */
+	double au = u * solidAngle + k;
+	double fu = (cos(au) * b0 - b1) / sin(au);
+	double cu = (fu > 0.0 ? 1.0 : -1.0) / sqrt(fu * fu + b0 * b0);
+	cu = max(-1.0, min(1.0, cu));
+	double xu = -(cu * z0) / sqrt(max(1e-12, 1.0 - cu * cu));
+	xu = max(x0, min(x1, xu));
+	/* v picks y along that column, by the height it subtends */
+	double dist = sqrt(xu * xu + z0 * z0);
+	double h0 = y0 / sqrt(dist * dist + y0 * y0);
+	double h1 = y1 / sqrt(dist * dist + y1 * y1);
+	double hv = h0 + v * (h1 - h0), hv2 = hv * hv;
+	double yv = hv2 < 1.0 - 1e-12 ? (hv * dist) / sqrt(1.0 - hv2) : y1;
+	return o + x * xu + y * yv + z * z0;
+}
@@ -0,0 +1,31 @@
+#ifndef SPHERICALRECT_H
+#define SPHERICALRECT_H
+
+#include "basic_constructs.h"
+
+/*
+ * A rectangle as seen from a point: the solid angle it covers, and points
+ * on it spread uniformly over that solid angle rather than its area
+ * (Urena, Fajardo and King, An Area-Preserving Parametrization for
+ * Spherical Rectangles, 2013). Stratified (u, v) give stratified
+ * directions. The rectangle is taken in a frame of its own edges with
+ * the point at the origin, see sample.
+ */
+class sphericalrect {
+	public:
+		sphericalrect () : solidAngle(0.0) {}
+		/* Corner c and edges ex, ey, which must be at right angles, seen from o */
+		sphericalrect (const point &c, const mvector &ex, const mvector &ey, const point &o);
+		/* Steradians, 0 if o is in the rectangle's plane */
+		double solidAngle;
+		/* The point for (u, v) in [0, 1)^2 */
+		point sample (double u, double v) const;
+
+	private:
+		point o;
+		mvector x, y, z;
+		double x0, x1, y0, y1, z0;
+		double b0, b1, k;
+};
+
+#endif
@@ -2,11 +2,39 @@
 #define SURFACE_H
 
 #include "basic_constructs.h"
+#include "contenthash.h"
 
 class surface {
 	public:
-		virtual bool intersect (const ray &r, double start, double end, intersection &info, bool useBBox) =0;
+		/* On a hit, info.n must be unit length */
+		virtual bool intersect (const ray &r, double start, double end, intersection &info) =0;
+		/* Bounding box preview: intersect the surface's box instead */
+		virtual bool intersectBBox (const ray &r, double start, double end, intersection &info) {
+			double t;
+			if (!box.intersect(r, start, end, t))
+				return false;
+			info.n = box.getNormal(r.evaluate(t));
+			info.t = t;
+			info.mat = mat;
+			return true;
+		}
 		void setMaterial (int m) { mat = m; }
+		/* Moves the surface and refits its box */
+		virtual void translate (const mvector &delta) =0;
+		/* Adds the shape, not the material, to h */
+		virtual void hash (contenthash &h) const =0;
+		/*
+		 * A copy of the surface built at slot, which holds a surface of the
+		 * same type that is no longer needed. 0 if this type owns memory
+		 * others point into, so its surfaces must stay where they are.
+		 */
+		virtual surface* relocate (void *) const {
+			return 0;
+		}
+		/* False if box does not bound the surface */
+		virtual bool bounded () const {
+			return true;
+		}
 		virtual ~surface() {}
 		int mat;
 		bbox box;
@@ -0,0 +1,205 @@
+#include "telemetry.h"
+#include "workers.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+telemetry::telemetry () {
+	slots = static_cast<counter*>(sharedAlloc(sizeof(counter) * maxThreads));
+	intervalMs = 1000;
+	totalPixels = 0;
+	startTime = 0.0;
+	finalRays = 0;
+	finalSeconds = 0.0;
+	sock = -1;
+	running = false;
+	console = true;
+	pthread_mutex_init(&lock, 0);
+	pthread_cond_init(&wake, 0);
+}
+
+telemetry::~telemetry () {
+	stop();
+	if (sock >= 0)
+		close(sock);
+	pthread_cond_destroy(&wake);
+	pthread_mutex_destroy(&lock);
+	sharedFree(slots, sizeof(counter) * maxThreads);
+}
+
+void telemetry::setTarget (const string &t, int interval) {
+	target = t;
+	if (interval > 0)
+		intervalMs = interval;
+	if (target.compare(0, 5, "unix:") == 0)
+		sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+}
+
+void telemetry::start (long total) {
+	if (running)
+		return;
+	memset(slots, 0, sizeof(counter) * maxThreads);
+	totalPixels = total;
+	startTime = now();
+	running = true;
+	if (pthread_create(&reporter, 0, reporterMain, this) != 0) {
+		cerr << "telemetry: could not start reporter thread" << endl;
+		running = false;
+	}
+}
+
+void telemetry::stop () {
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	running = false;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(reporter, 0);
+	sample(true);
+}
+
+void* telemetry::reporterMain (void *self) {
+	telemetry *t = static_cast<telemetry*>(self);
+	pthread_mutex_lock(&t->lock);
+	while (t->running) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += t->intervalMs / 1000;
+		until.tv_nsec += (t->intervalMs % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&t->wake, &t->lock, &until);
+		if (!t->running)
+			break;
+		pthread_mutex_unlock(&t->lock);
+		t->sample(false);
+		pthread_mutex_lock(&t->lock);
+	}
+	pthread_mutex_unlock(&t->lock);
+	return 0;
+}
+
+double telemetry::now () {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Resident set size from /proc, 0 if unavailable */
+long telemetry::residentBytes () {
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+void telemetry::sample (bool done) {
+	unsigned long pixels = 0, rays = 0;
+	for (int s = 0; s < maxThreads; ++s) {
+		pixels += __sync_fetch_and_add(&slots[s].pixels, 0);
+		rays += __sync_fetch_and_add(&slots[s].rays, 0);
+	}
+	double secs = now() - startTime;
+	double percent = totalPixels ? 100.0 * pixels / totalPixels : 100.0;
+	double raysPerSec = secs > 0.0 ? rays / secs : 0.0;
+	double eta = pixels ? secs * (totalPixels - (long) pixels) / pixels : -1.0;
+	if (done) {
+		finalRays = rays;
+		finalSeconds = secs;
+		eta = 0.0;
+	}
+
+	if (console)
+		cout << "Progress : " << (int) percent << "%\r" << flush;
+
+	if (target.empty())
+		return;
+	ostringstream line;
+	line << "state=" << (done ? "done" : "rendering")
+		 << " percent=" << percent
+		 << " pixels=" << pixels << "/" << totalPixels
+		 << " rays=" << rays
+		 << " rays_per_sec=" << (long) raysPerSec
+		 << " elapsed=" << secs
+		 << " eta=" << eta
+		 << " rss_bytes=" << residentBytes();
+	pthread_mutex_lock(&lock);
+	lastLine = line.str();
+	pthread_mutex_unlock(&lock);
+	republish();
+}
+
+void telemetry::annotate (const string &key, double value) {
+	ostringstream text;
+	text << value;
+	setNote(key, text.str());
+}
+
+void telemetry::annotate (const string &key, size_t value) {
+	ostringstream text;
+	text << value;
+	setNote(key, text.str());
+}
+
+void telemetry::setNote (const string &key, const string &value) {
+	pthread_mutex_lock(&lock);
+	size_t n = 0;
+	while (n < notes.size() && notes[n].first != key)
+		++n;
+	if (n == notes.size())
+		notes.push_back(make_pair(key, value));
+	else
+		notes[n].second = value;
+	pthread_mutex_unlock(&lock);
+}
+
+void telemetry::republish () {
+	if (target.empty())
+		return;
+	pthread_mutex_lock(&lock);
+	ostringstream line;
+	line << lastLine;
+	for (size_t n = 0; n < notes.size(); ++n)
+		line << " " << notes[n].first << "=" << notes[n].second;
+	line << "\n";
+	pthread_mutex_unlock(&lock);
+	if (!lastLine.empty())
+		emit(line.str());
+}
+
+void telemetry::emit (const string &line) {
+	if (sock >= 0) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, target.c_str() + 5, sizeof(addr.sun_path) - 1);
+		/* Nobody listening is fine, the scheduler may attach later */
+		sendto(sock, line.data(), line.size(), MSG_DONTWAIT,
+				(struct sockaddr *) &addr, sizeof(addr));
+		return;
+	}
+	/* Write aside and rename so readers never see a partial file */
+	string tmp = target + ".tmp";
+	ofstream out(tmp.c_str());
+	if (!out)
+		return;
+	out << line;
+	out.close();
+	if (rename(tmp.c_str(), target.c_str()) != 0)
+		cerr << "telemetry: could not update " << target << ": " << strerror(errno) << endl;
+}
@@ -0,0 +1,92 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <cstddef>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include "perfcounters.h"
+
+/*
+ * Render statistics, gathered off the render loop.
+ *
+ * Each rendering thread or worker process owns one counter slot and
+ * publishes its running pixel and ray totals into it once per scanline;
+ * the slots are in shared memory so forked workers can publish too, and
+ * hand back their performance counts there as they finish. A
+ * background reporter wakes up every interval, sums the slots and
+ * publishes rays/sec, percent done, ETA and resident memory. The target is either a stats file
+ * (rewritten atomically every interval) or, if prefixed with "unix:",
+ * a datagram Unix socket that gets one line per sample.
+ */
+class telemetry {
+	public:
+		static const int maxThreads = 64;
+		telemetry ();
+		~telemetry ();
+		/* target may be empty, then only console progress is shown */
+		void setTarget (const std::string &target, int intervalMs);
+		/* Console progress is on by default */
+		void setConsole (bool on) { console = on; }
+		void start (long totalPixels);
+		void stop ();
+		/* Called by render thread or worker `thread` with its running totals */
+		void publish (int thread, unsigned long pixels, unsigned long rays) {
+			counter &c = slots[thread];
+			__sync_lock_test_and_set(&c.pixels, pixels);
+			__sync_lock_test_and_set(&c.rays, rays);
+		}
+		/* Called by worker `thread` as it finishes, with perfcounters::counts of its events */
+		void publishEvents (int thread, const unsigned long long *counts) {
+			for (int e = 0; e < perfcounters::NUM_EVENTS; ++e)
+				slots[thread].events[e] = counts[e];
+		}
+		/* What worker `thread` published, 0 if it exited without publishing */
+		void events (int thread, unsigned long long *counts) const {
+			for (int e = 0; e < perfcounters::NUM_EVENTS; ++e)
+				counts[e] = slots[thread].events[e];
+		}
+		/* Adds key=value to every line from now on, replacing an earlier value for key */
+		void annotate (const std::string &key, double value);
+		/* Counts and byte sizes, written out in full */
+		void annotate (const std::string &key, size_t value);
+		/* Sends the last line again, with the current annotations */
+		void republish ();
+		unsigned long totalRays () const { return finalRays; }
+		double elapsed () const { return finalSeconds; }
+		/* Monotonic seconds */
+		static double now ();
+
+	private:
+		void setNote (const std::string &key, const std::string &value);
+		/* One cache line per thread so slots never share a line */
+		struct counter {
+			volatile unsigned long pixels, rays;
+			volatile unsigned long long events[perfcounters::NUM_EVENTS];
+			char pad[64 - 2*sizeof(unsigned long) - perfcounters::NUM_EVENTS*sizeof(unsigned long long)];
+		};
+		counter *slots;
+		std::string target;
+		/* Annotations as written out, in the order they were first added */
+		std::vector<std::pair<std::string, std::string> > notes;
+		std::string lastLine;
+		int intervalMs;
+		long totalPixels;
+		double startTime;
+		unsigned long finalRays;
+		double finalSeconds;
+		int sock;
+		bool running;
+		bool console;
+		pthread_t reporter;
+		pthread_mutex_t lock;
+		pthread_cond_t wake;
+
+		static void* reporterMain (void *self);
+		static long residentBytes ();
+		void sample (bool done);
+		void emit (const std::string &line);
+};
+
+#endif
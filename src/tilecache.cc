@@ -0,0 +1,184 @@
+#include "tilecache.h"
+#include "sceneobjects.h"
+#include "montecarlo.h"
+#include "contenthash.h"
+#include "workers.h"
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unistd.h>
+#include <sys/stat.h>
+using namespace std;
+
+static const char magic[8] = {'r', 'a', 'y', 't', 'i', 'l', 'e', '1'};
+
+/* What the file holds ahead of the pixels */
+struct tileheader {
+	char magic[8];
+	int width, height;
+	double reachMin[3], reachMax[3];
+	int escapes;
+	unsigned long long geometry;
+};
+
+tilecache::tilecache (const string &d, const sceneobjects &objs, const camerainfo &ci, const renderoptions &opts)
+: dir(d) {
+	if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+		cerr << "tile cache: can't create " << dir << ": " << strerror(errno) << endl;
+	hits = static_cast<volatile int*>(sharedAlloc(sizeof(int)));
+
+	/* Everything that reaches every tile */
+	contenthash h;
+	h.add(ci.eye);
+	h.add(ci.u);
+	h.add(ci.v);
+	h.add(ci.w);
+	h.add(ci.d);
+	h.add(ci.nx);
+	h.add(ci.ny);
+	h.add(ci.l);
+	h.add(ci.r);
+	h.add(ci.t);
+	h.add(ci.b);
+	h.add(opts.pixelSamples);
+	h.add(opts.shadowSamples);
+	h.add((int) opts.useBBox);
+	h.add(opts.maxDepth);
+	h.add(opts.minThroughput);
+	h.add((int) opts.russianRoulette);
+	h.add(opts.rouletteDepth);
+	h.add((unsigned long long) opts.seed);
+	h.add(opts.firstSample);
+	h.add(opts.sampleCount);
+	h.add((int) opts.adaptiveShadows);
+	h.add((int) opts.solidAngleLights);
+	for (size_t l = 0; l < objs.lights.size(); ++l) {
+		light *lt = objs.lights[l];
+		h.add((int) lt->getLightType());
+		h.add(lt->getPosition());
+		h.add(lt->spectralD());
+		if (lt->getLightType() == light::AREA) {
+			s_light *sl = static_cast<s_light*>(lt);
+			h.add(sl->dir);
+			h.add(sl->u);
+			h.add(sl->v);
+			h.add(sl->len);
+		}
+	}
+	h.add(objs.al.intensity());
+	key = h.value();
+
+	double inf = numeric_limits<double>::infinity();
+	sceneBounds.min = point(inf, inf, inf);
+	sceneBounds.max = point(-inf, -inf, -inf);
+	for (size_t s = 0; s < objs.surfaces.size(); ++s) {
+		const surface *sf = objs.surfaces[s];
+		const material &m = objs.materials[sf->mat];
+		contenthash sh;
+		sf->hash(sh);
+		sh.add(m.diffuse);
+		sh.add(m.specular);
+		sh.add(m.ideal_reflective);
+		sh.add(m.phong_exponent);
+		surfaceHashes.push_back(sh.value());
+		surfaceBounded.push_back(sf->bounded());
+		surfaceBoxes.push_back(sf->box);
+		if (sf->bounded()) {
+			sceneBounds.min.x = min(sceneBounds.min.x, sf->box.min.x);
+			sceneBounds.min.y = min(sceneBounds.min.y, sf->box.min.y);
+			sceneBounds.min.z = min(sceneBounds.min.z, sf->box.min.z);
+			sceneBounds.max.x = max(sceneBounds.max.x, sf->box.max.x);
+			sceneBounds.max.y = max(sceneBounds.max.y, sf->box.max.y);
+			sceneBounds.max.z = max(sceneBounds.max.z, sf->box.max.z);
+		}
+	}
+}
+
+tilecache::~tilecache () {
+	sharedFree((void*) hits, sizeof(int));
+}
+
+string tilecache::fileName (const Box2i &tile) const {
+	contenthash h;
+	h.add(key);
+	h.add(tile.min.x);
+	h.add(tile.min.y);
+	h.add(tile.max.x);
+	h.add(tile.max.y);
+	char name[32];
+	sprintf(name, "/%016llx.tile", h.value());
+	return dir + name;
+}
+
+/* Surfaces touching the reach, in scene order, and the scene bounds if rays escaped */
+unsigned long long tilecache::geometryHash (const point &lo, const point &hi, bool escapes) const {
+	contenthash h;
+	for (size_t s = 0; s < surfaceHashes.size(); ++s) {
+		const bbox &b = surfaceBoxes[s];
+		if (!surfaceBounded[s] || (b.min.x <= hi.x && b.max.x >= lo.x && b.min.y <= hi.y && b.max.y >= lo.y &&
+								   b.min.z <= hi.z && b.max.z >= lo.z))
+			h.add(surfaceHashes[s]);
+	}
+	if (escapes) {
+		h.add(sceneBounds.min);
+		h.add(sceneBounds.max);
+	}
+	return h.value();
+}
+
+bool tilecache::load (const Box2i &tile, fpixel *pixels, int nx) {
+	FILE *f = fopen(fileName(tile).c_str(), "rb");
+	if (!f)
+		return false;
+	int width = tile.max.x - tile.min.x + 1;
+	int height = tile.max.y - tile.min.y + 1;
+	tileheader th;
+	bool valid = fread(&th, sizeof(th), 1, f) == 1 && !memcmp(th.magic, magic, sizeof(magic)) &&
+				 th.width == width && th.height == height &&
+				 th.geometry == geometryHash(point(th.reachMin[0], th.reachMin[1], th.reachMin[2]),
+											 point(th.reachMax[0], th.reachMax[1], th.reachMax[2]), th.escapes);
+	/* Read into scratch first, a short file must not leave a half written tile */
+	vector<fpixel> data(valid ? (size_t) width * height : 0);
+	if (valid)
+		valid = fread(&data[0], sizeof(fpixel), data.size(), f) == data.size();
+	fclose(f);
+	if (!valid)
+		return false;
+	for (int j = 0; j < height; ++j)
+		memcpy(&pixels[(tile.min.y + j) * nx + tile.min.x], &data[(size_t) j * width], sizeof(fpixel) * width);
+	__sync_fetch_and_add(hits, 1);
+	return true;
+}
+
+void tilecache::store (const Box2i &tile, const fpixel *pixels, int nx, const point &lo, const point &hi,
+					   bool escapes) {
+	tileheader th;
+	memset(&th, 0, sizeof(th));
+	memcpy(th.magic, magic, sizeof(magic));
+	th.width = tile.max.x - tile.min.x + 1;
+	th.height = tile.max.y - tile.min.y + 1;
+	th.reachMin[0] = lo.x;
+	th.reachMin[1] = lo.y;
+	th.reachMin[2] = lo.z;
+	th.reachMax[0] = hi.x;
+	th.reachMax[1] = hi.y;
+	th.reachMax[2] = hi.z;
+	th.escapes = escapes;
+	th.geometry = geometryHash(lo, hi, escapes);
+
+	/* Write aside and rename so a concurrent reader never sees a partial tile */
+	string name = fileName(tile);
+	char tmp[32];
+	sprintf(tmp, ".%d", (int) getpid());
+	string tmpName = name + tmp;
+	FILE *f = fopen(tmpName.c_str(), "wb");
+	if (!f)
+		return;
+	bool ok = fwrite(&th, sizeof(th), 1, f) == 1;
+	for (int j = tile.min.y; ok && j <= tile.max.y; ++j)
+		ok = fwrite(&pixels[j * nx + tile.min.x], sizeof(fpixel), th.width, f) == (size_t) th.width;
+	if (fclose(f) != 0 || !ok || rename(tmpName.c_str(), name.c_str()) != 0)
+		unlink(tmpName.c_str());
+}
@@ -0,0 +1,60 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <string>
+#include <vector>
+#include <ImathBox.h>
+#include "basic_constructs.h"
+#include "renderoptions.h"
+
+using namespace Imath;
+
+class sceneobjects;
+class camerainfo;
+
+/*
+ * Finished tiles on disk, reused by later renders whose inputs for that
+ * tile are unchanged (renderoptions::tileCache).
+ *
+ * A tile's file is named by a hash of the camera, the sampling options,
+ * the seed, the lights and the tile bounds. Geometry is checked
+ * separately: rendering a tile records its reach, the box around every
+ * ray segment it traced, with rays that left the scene clipped to the
+ * scene bounds. Only surfaces whose boxes touch the reach can have
+ * affected the tile, so it is reused while the hash of those surfaces
+ * (shape and material contents), and of the scene bounds if rays
+ * escaped, still matches. Editing an object re-renders only the tiles
+ * whose rays came near it.
+ */
+class tilecache {
+	public:
+		tilecache (const std::string &dir, const sceneobjects &objs, const camerainfo &ci, const renderoptions &opts);
+		~tilecache ();
+		/* Copies the tile into pixels, nx wide, if it is cached and still valid */
+		bool load (const Box2i &tile, fpixel *pixels, int nx);
+		void store (const Box2i &tile, const fpixel *pixels, int nx, const point &reachMin, const point &reachMax,
+					bool escapes);
+		/* Bounds of the bounded surfaces, for clipping escaping rays */
+		const bbox& bounds () const {
+			return sceneBounds;
+		}
+		/* Tiles loaded so far, by all processes */
+		int reused () const {
+			return *hits;
+		}
+
+	private:
+		std::string dir;
+		unsigned long long key;
+		/* Per surface hash of shape and material, and whether its box bounds it */
+		std::vector<unsigned long long> surfaceHashes;
+		std::vector<bool> surfaceBounded;
+		std::vector<bbox> surfaceBoxes;
+		bbox sceneBounds;
+		volatile int *hits;
+
+		std::string fileName (const Box2i &tile) const;
+		unsigned long long geometryHash (const point &reachMin, const point &reachMax, bool escapes) const;
+};
+
+#endif
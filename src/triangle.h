@@ -8,11 +8,79 @@ class triangle: public surface {
 	public:
 		point p1, p2, p3;
 		triangle (const point p1, const point p2, const point p3);
-		bool intersect (const ray &r, double start, double end, intersection &info, bool useBBox);
+		bool intersect (const ray &r, double start, double end, intersection &info);
+		void translate (const mvector &delta);
+		void hash (contenthash &h) const {
+			h.add('t');
+			h.add(p1);
+			h.add(p2);
+			h.add(p3);
+		}
 		mvector getNormal();
+		/* Ray against the triangle p1 p2 p3, sets t if it hits inside (start, end) */
+		static inline bool solve (const point &p1, const point &p2, const point &p3, const ray &r,
+								  double start, double end, double &t);
+		surface* relocate (void *slot) const;
 		virtual ~triangle();
 	private:
 		mvector n;
 };
 
+/*
+ * System of equations to solve. e coefficient is r.p. a,b,c are triangle points.
+ * xa-xb xa-xc xd		B		xa-xe
+ * ya-yb ya-yc yd	X	y	= 	ya-ye
+ * za-zb za-zc zd		t		za-ze
+ *
+ * a     d     g		B		j
+ * b     e     h	X	y	= 	k
+ * c     f     i		y		l
+ *
+ * Using Cramer,
+ * B * M =   j(ei - hf) + k(gf - di) + l(dh - eg)
+ * y * M =   i(ak - jb) + h(jc - al) + g(bl - kc)
+ * t * M = - f(ak - jb) + e(jc - al) + d(bl - kc)
+ * M 	 =   a(ei - hf) + b(gf - di) + c(dh - eg)
+ */
+bool triangle::solve (const point &p1, const point &p2, const point &p3, const ray &r,
+					  double start, double end, double &t) {
+	double a = p1.x - p2.x;
+	double b = p1.y - p2.y;
+	double c = p1.z - p2.z;
+	double d = p1.x - p3.x;
+	double e = p1.y - p3.y;
+	double f = p1.z - p3.z;
+	double g = r.d.x;
+	double h = r.d.y;
+	double i = r.d.z;
+	double j = p1.x - r.p.x;
+	double k = p1.y - r.p.y;
+	double l = p1.z - r.p.z;
+
+	double eihf = e*i - h*f;
+	double gfdi = g*f - d*i;
+	double dheg = d*h - e*g;
+
+	double M = a*eihf + b*gfdi + c*dheg;
+	if (M == 0)
+		return false;
+
+	double akjb = a*k - j*b;
+	double jcal = j*c - a*l;
+	double blkc = b*l - k*c;
+
+	t = (f*akjb + e*jcal + d*blkc)/-M;
+	if (t <= start || t >= end)
+		return false;
+
+	double y = (i*akjb + h*jcal + g*blkc)/M;
+	if (y < 0 || y > 1)
+		return false;
+
+	double B = (j*eihf + k*gfdi + l*dheg)/M;
+	if (B < 0 || B > 1-y)
+		return false;
+	return true;
+}
+
 #endif
@@ -0,0 +1,152 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "workers.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+using namespace std;
+
+void* sharedAlloc (size_t bytes) {
+	void *p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		ostringstream error;
+		error << "can't map " << bytes << " bytes of shared memory: " << strerror(errno);
+		throw runtime_error(error.str());
+	}
+	return p;
+}
+
+void sharedFree (void *p, size_t bytes) {
+	if (p)
+		munmap(p, bytes);
+}
+
+tilequeue::tilequeue (const Box2i &r, int size) {
+	region = r;
+	tileSize = size > 0 ? size : 32;
+	tilesX = (region.max.x - region.min.x + tileSize) / tileSize;
+	tilesY = (region.max.y - region.min.y + tileSize) / tileSize;
+	sharedBytes = sizeof(int) + count();
+	char *mem = static_cast<char*>(sharedAlloc(sharedBytes));
+	next = reinterpret_cast<volatile int*>(mem);
+	state = mem + sizeof(int);
+}
+
+tilequeue::~tilequeue () {
+	sharedFree((void *) next, sharedBytes);
+}
+
+bool tilequeue::claim (int &tile) {
+	int t = __sync_fetch_and_add(next, 1);
+	if (t >= count())
+		return false;
+	state[t] = CLAIMED;
+	tile = t;
+	return true;
+}
+
+void tilequeue::finish (int tile) {
+	/* Pixels of the tile must be visible before it reads as done */
+	__sync_synchronize();
+	state[tile] = DONE;
+}
+
+bool tilequeue::isDone (int tile) const {
+	return state[tile] == DONE;
+}
+
+Box2i tilequeue::bounds (int tile) const {
+	int x0 = region.min.x + (tile % tilesX) * tileSize;
+	int y0 = region.min.y + (tile / tilesX) * tileSize;
+	return Box2i(V2i(x0, y0), V2i(min(x0 + tileSize - 1, region.max.x),
+								  min(y0 + tileSize - 1, region.max.y)));
+}
+
+/* Cpus of a NUMA node from sysfs, false if there is no such node */
+static bool nodeCpus (int node, cpu_set_t &cpus) {
+	ostringstream path;
+	path << "/sys/devices/system/node/node" << node << "/cpulist";
+	ifstream in(path.str().c_str());
+	string list;
+	if (!(in >> list))
+		return false;
+	CPU_ZERO(&cpus);
+	/* Format is like 0-3,8-11 */
+	istringstream ranges(list);
+	string range;
+	while (getline(ranges, range, ',')) {
+		int first = atoi(range.c_str()), last = first;
+		size_t dash = range.find('-');
+		if (dash != string::npos)
+			last = atoi(range.c_str() + dash + 1);
+		for (int c = first; c <= last && c < CPU_SETSIZE; ++c)
+			CPU_SET(c, &cpus);
+	}
+	return true;
+}
+
+static void pinToNode (int worker) {
+	vector<cpu_set_t> nodes;
+	cpu_set_t cpus;
+	while (nodeCpus((int) nodes.size(), cpus))
+		nodes.push_back(cpus);
+	if (nodes.empty())
+		return;
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &nodes[worker % nodes.size()]) != 0)
+		cerr << "worker " << worker << ": can't pin to NUMA node: " << strerror(errno) << endl;
+}
+
+int forkWorkers (int n, bool pinNodes, void (*work)(int worker, void *ctx), void *ctx) {
+	vector<pid_t> pids;
+	vector<int> ids;
+	/* Children would otherwise flush the parent's buffered output again */
+	cout.flush();
+	cerr.flush();
+	for (int k = 0; k < n; ++k) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			cerr << "can't fork worker " << k << ": " << strerror(errno) << endl;
+			continue;
+		}
+		if (pid == 0) {
+			if (pinNodes)
+				pinToNode(k);
+			/* Skip destructors, they belong to the parent */
+			try {
+				work(k, ctx);
+			} catch (const exception &e) {
+				cerr << "worker " << k << ": " << e.what() << endl;
+				_exit(1);
+			}
+			_exit(0);
+		}
+		pids.push_back(pid);
+		ids.push_back(k);
+	}
+
+	int failed = n - (int) pids.size();
+	for (size_t w = 0; w < pids.size(); ++w) {
+		int status;
+		while (waitpid(pids[w], &status, 0) < 0 && errno == EINTR)
+			;
+		if (WIFSIGNALED(status)) {
+			cerr << "worker " << ids[w] << " died with signal " << WTERMSIG(status) << endl;
+			++failed;
+		} else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			cerr << "worker " << ids[w] << " failed" << endl;
+			++failed;
+		}
+	}
+	return failed;
+}
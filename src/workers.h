@@ -0,0 +1,50 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <cstddef>
+#include <ImathBox.h>
+
+using namespace Imath;
+
+/*
+ * Anonymous memory that stays shared between a process and its forked
+ * children. Throws runtime_error if it can't be mapped, so a server can
+ * fail the one job instead of exiting.
+ */
+void* sharedAlloc (size_t bytes);
+void sharedFree (void *p, size_t bytes);
+
+/*
+ * A region cut into square tiles. The claim/finish state lives in shared
+ * memory, so forked workers pull tiles from one queue and the parent can
+ * see afterwards which tiles were never finished (a worker crashed).
+ */
+class tilequeue {
+	public:
+		tilequeue (const Box2i &region, int tileSize);
+		~tilequeue ();
+		int count () const {
+			return tilesX * tilesY;
+		}
+		/* Next unclaimed tile, false when there are none left */
+		bool claim (int &tile);
+		void finish (int tile);
+		bool isDone (int tile) const;
+		Box2i bounds (int tile) const;
+	private:
+		enum {TODO, CLAIMED, DONE};
+		Box2i region;
+		int tileSize, tilesX, tilesY;
+		size_t sharedBytes;
+		volatile int *next;
+		volatile char *state;
+};
+
+/*
+ * Forks n workers, each running work(k, ctx) for k in [0, n), and waits
+ * for them. With pinNodes, worker k is bound to the cpus of NUMA node
+ * k % nodes. Returns how many workers did not exit cleanly.
+ */
+int forkWorkers (int n, bool pinNodes, void (*work)(int worker, void *ctx), void *ctx);
+
+#endif
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Checks that --region is refused when it holds no pixels of the image.
+# Usage: test/regions.sh path/to/raytra
+raytra=${1:-./raytra}
+dir=$(dirname "$0")
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+failed=0
+
+# expect STATUS MESSAGE ARGS...: raytra exits with STATUS and, if given, says MESSAGE
+expect () {
+	status=$1
+	message=$2
+	shift 2
+	"$raytra" "$dir/scenefile" "$out/region.exr" 1 1 --seed 1 "$@" > "$out/log" 2>&1
+	got=$?
+	if [ $got -ne $status ] || { [ -n "$message" ] && ! grep -q "$message" "$out/log"; }; then
+		echo "FAIL: $*: exit $got"
+		cat "$out/log"
+		failed=1
+	fi
+}
+
+# scenefile's camera is 800x600
+expect 1 "lies outside the 800x600 image" --region 900 0 950 10
+expect 1 "lies outside the 800x600 image" --region 0 600 10 700
+expect 1 "needs x0 <= x1" --region 20 0 10 10
+expect 0 "" --region 790 590 900 700
+
+[ $failed -eq 0 ] && echo "regions: ok"
+exit $failed